@@ -12,6 +12,9 @@
 #ifndef ColorBasedTracker_HPP_INCLUDE
 #define ColorBasedTracker_HPP_INCLUDE
 
+#include "HistogramEngine.hpp"
+#include "SearchEngine.hpp"
+
 using namespace cv;
 using namespace std;
 
@@ -22,7 +25,7 @@ namespace tracker {
 	//Public functions
 	public:
 		//constructor function
-		ColorBasedTracker(Mat frame, Rect ground_truth, int bins, int cand, int pix_stride, int channel_id, bool normal);
+		ColorBasedTracker(Mat frame, Rect ground_truth, int bins, int cand, int pix_stride, int channel_id, bool normal, int histogram_mode);
 
 		//destructor function
 		~ColorBasedTracker(void);
@@ -30,28 +33,79 @@ namespace tracker {
 		//generating candidates
 		vector<Rect>  generate_candidates(void);
 
+		//removes candidates lying (partly) out of the frame
+		void discard_out_of_frame(vector<Rect> &candidates);
+
+		//top left corners of candidates lying inside the frame
+		Rect candidate_origins(Size frame_size);
+
+		//sets up coarse-to-fine search (has to be called before tracking, the coarse template is taken from the first frame)
+		void configure_pyramid(int levels, int top_k);
+
+		//generating candidates by coarse-to-fine search (pyramid.levels > 0)
+		vector<Rect>  pyramid_candidates(void);
+
+		//generating candidates by block-matching pattern search (search_strategy 1, 2 and 3)
+		vector<Rect>  pattern_candidates(void);
+
+		//generating the candidate by meanShift or CamShift over the back-projection of gt_hist (shift_mode 1 and 2)
+		vector<Rect>  shift_candidates(void);
+
+		//calculate histogram of the rectangle of the coarse level
+		Mat coarse_histogram(Rect rectangle);
+
 		//scoring and choosing best candidate
 		Rect find_best_candidate(vector<Rect> candidates);
 
+		//scoring candidates, returns index of the best one (last prediction is not moved)
+		int best_candidate_index(const vector<Rect> &candidates, Point anchor);
+
 		//executes step for every frame
 		Rect execute_tracking_step(Mat frame);
 
+		//moves last prediction to the position predicted by the Kalman filter and sizes the grid (kalman_search)
+		void predict_search_window(Size frame_size);
+
 		// extracrs channel of interest from frame
 		void convert_RGB_to_channel(Mat frame);
 
 		//calculate histogram for the candidate
 		Mat calculate_histogram(Rect rectangle, const float * range[]);
 
+		//counts bins of the candidate from the quantized frame (hist_mode 1, 2 and 3)
+		const int * count_candidate(Rect rectangle);
+
+		//counts bins of all candidates to candidates_counts (hist_mode 1, 2 and 3)
+		void count_all_candidates(const vector<Rect> &candidates);
+
+		//scores counts of all candidates at once (score_mode 1, 2 and 3), or their likelihood (score_mode 4)
+		const vector<float> & score_all_candidates(const vector<Rect> &candidates);
+
+		//order of scoring candidates (nearest the anchor first, if nearest_first)
+		vector<int> scoring_order(const vector<Rect> &candidates, bool nearest_first, Point anchor);
+
+		//bounding box of the candidates grid around last prediction
+		Rect compute_search_region(Size frame_size);
+
+		//converts the part of the rectangle lying out of the search region
+		void convert_outside_region(Rect rectangle);
+
 		// ground truth histogram of the tracked object (taken from first frame)
 		Mat gt_hist;
-		// actual frame (with already extracted channel of interest)
+		// actual frame (with already extracted channel of interest, valid only inside the search region)
 		Mat actual_frame;
+		// part of the frame read by the tracker (bounding box of all candidates), only this part is converted
+		Rect search_region;
+		// frame passed to convert_RGB_to_channel, not copied (pixels out of the search region are converted from it on demand)
+		Mat current_frame;
 		// algortihm's prediction of object's position established in the previous frame
 		Rect last_prediction;
 		// [cand_param x cand_param] is amount of candidates generated in every frame
 		// (cand_param is side of the grid used to candidates generation,
 		// thus the total candidate amount is cand_param x cand_param)
 		int cand_param;
+		// largest side of the grid (cand_param given to the constructor, kalman_search only shrinks the grid)
+		int cand_param_max;
 		// the pixel distance between candidates rectangles generated in grid
 		int p_stride;
 		//the id of channel of interest for tracker
@@ -71,6 +125,84 @@ namespace tracker {
 		// range of values - parameter for histogram
 		float ranges[2];
 
+		//the way candidates histograms are computed
+		// 0 - calcHist for every candidate (reference)
+		// 1 - integral histogram built once per frame over the search region
+		// 2 - sliding window scan along the candidates grid rows
+		// 3 - SIMD counting kernel for every candidate
+		int hist_mode;
+
+		// actual frame quantized to bins indexes (used in hist_mode 1, 2 and 3)
+		BinPlane actual_bins;
+		// integral histogram of the search region of the actual frame (built once per frame in hist_mode 1)
+		IntegralHistogram integral_hist;
+		// bins counts of the candidate, bins_param + 1 values (reused by every candidate)
+		vector<int> counts_buffer;
+		// bins counts of all candidates of the actual frame (used in hist_mode 2 and batched scoring)
+		vector<int> candidates_counts;
+		// bins counts of all candidates as ushort (used in score_mode 3, if the candidate area fits)
+		vector<ushort> candidates_counts_short;
+		// tells if counts of the actual frame are in candidates_counts_short
+		bool short_counts;
+		// scoring loop instantiated for bins_param (0 if there is none, or in hist_mode 0)
+		HistogramScorer histogram_scorer;
+
+		//the way candidates histograms are scored (hist_mode 1, 2 and 3; hist_mode 0 always scores one by one)
+		// 0 - one candidate at a time (compareHist or fixed size Histogram)
+		// 1 - all candidates at once, batched Bhattacharyya over structure of arrays
+		// 2 - all candidates at once, Hellinger embedding scored with one matrix-vector product
+		// 3 - all candidates at once, integer counts with square root lookup table and fixed point coefficient
+		// 4 - all candidates at once, mean log-ratio weight of pixels (likelihood map, one integral image, no histograms)
+		int score_mode;
+		// batched scorer with the precomputed template (used in score_mode 1)
+		BatchBhattacharyya batch_scorer;
+		// embedded template and candidates (used in score_mode 2)
+		HellingerEmbedding hellinger_scorer;
+		// integer scorer with the fixed point template and square root table (used in score_mode 3)
+		IntegerBhattacharyya integer_scorer;
+		// bins log-ratio weights and their integral image over the search region (used in score_mode 4)
+		LikelihoodMap likelihood_map;
+
+		//tells if candidates are scored nearest last prediction first and abandoned as soon as they cannot beat
+		//the best distance so far (candidates scored one at a time)
+		bool early_termination;
+		// scorer with early termination and its skip counters (used with early_termination)
+		BoundedBhattacharyya bounded_scorer;
+
+		//the way the object is searched
+		// 0 - candidates scored against gt_hist (grid, pyramid or pattern search)
+		// 1 - meanShift over the back-projection of gt_hist in the search region
+		// 2 - CamShift over the back-projection of gt_hist in the search region (adapts the box size)
+		int shift_mode;
+		// gt_hist scaled to [0, 255], so its back-projection is an 8-bit likelihood image
+		Mat backproject_hist;
+		// back-projection of the search region of the actual frame (used in shift_mode 1 and 2)
+		Mat backprojection;
+		// termination of meanShift and CamShift iterations
+		TermCriteria shift_criteria;
+
+		//the way candidates are searched (without the pyramid search)
+		// 0 - the whole candidates grid
+		// 1 - three-step search
+		// 2 - diamond search
+		// 3 - hexagon-based search
+		int search_strategy;
+		// pattern geometry and its evaluation counters (used in search_strategy 1, 2 and 3)
+		PatternSearch pattern;
+		//tells if the search is centred on the position predicted by a constant-velocity Kalman filter
+		//and the candidates grid is sized from its innovation covariance
+		bool kalman_search;
+		// Kalman filter of the box position and the grid sides statistics (used with kalman_search)
+		MotionPredictor motion;
+		// candidates of the last execute_tracking_step (kept for visualisation)
+		vector<Rect> step_candidates;
+		// coarse-to-fine search geometry and its evaluation counters (used if pyramid.levels > 0)
+		PyramidSearch pyramid;
+		// search region of the actual frame downsampled by the pyramid (valid only with pyramid.levels > 0)
+		Mat coarse_frame;
+		// ground truth histogram of the tracked object on the coarse level (taken from first frame)
+		Mat coarse_gt_hist;
+
 	};
 }
 
@@ -0,0 +1,1026 @@
+/* Applied Video Sequence Analysis (AVSA)
+ *
+ *	LAB4: HistogramEngine
+ *	HistogramEngine.cpp
+ *
+ * 	Authors: Sergio Romero & Jan Sieradzki
+ *	IPCV & I2ICSI - 2021
+ */
+
+#include "HistogramEngine.hpp"
+
+#include <opencv2/opencv.hpp>
+
+// x86 vector kernels are compiled for their instruction set by target attributes and chosen at run time
+// (__builtin_cpu_supports), so the object file runs on any CPU of the architecture without special compiler flags
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HIST_X86_KERNELS
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#endif
+
+using namespace cv;
+using namespace std;
+using namespace tracker;
+
+#ifdef HIST_X86_KERNELS
+// vector operations used by the counting kernel, 32 pixels per vector (vectors are passed by reference,
+// so the kernel template can be instantiated inside the function compiled for the instruction set)
+struct HistAvx2{
+	typedef __m256i hist_vector;
+	static const int size = 32;
+	TARGET_AVX2 static inline void zero(hist_vector &v){ v = _mm256_setzero_si256(); }
+	TARGET_AVX2 static inline void set1(hist_vector &v, int value){ v = _mm256_set1_epi8((char)value); }
+	TARGET_AVX2 static inline void load(hist_vector &v, const uchar * p){ v = _mm256_loadu_si256((const __m256i *)p); }
+	// low and high 4-bit halves of the bytes
+	TARGET_AVX2 static inline void split(hist_vector &low, hist_vector &high, const hist_vector &values, const hist_vector &low_mask)
+	{
+		low = _mm256_and_si256(values, low_mask);
+		high = _mm256_and_si256(_mm256_srli_epi16(values, 4), low_mask);
+	}
+	// counters of lanes equal to the key are incremented (the compare mask is -1)
+	TARGET_AVX2 static inline void count_equal(hist_vector &counters, const hist_vector &values, const hist_vector &key)
+	{
+		counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(values, key));
+	}
+	// sum of the 8-bit counters
+	TARGET_AVX2 static inline int horizontal_sum(const hist_vector &counters)
+	{
+		__m256i sums = _mm256_sad_epu8(counters, _mm256_setzero_si256());
+		__m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+		return _mm_cvtsi128_si32(half) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(half, half));
+	}
+};
+
+// vector operations used by the counting kernel, 16 pixels per vector
+struct HistSse2{
+	typedef __m128i hist_vector;
+	static const int size = 16;
+	TARGET_SSE2 static inline void zero(hist_vector &v){ v = _mm_setzero_si128(); }
+	TARGET_SSE2 static inline void set1(hist_vector &v, int value){ v = _mm_set1_epi8((char)value); }
+	TARGET_SSE2 static inline void load(hist_vector &v, const uchar * p){ v = _mm_loadu_si128((const __m128i *)p); }
+	TARGET_SSE2 static inline void split(hist_vector &low, hist_vector &high, const hist_vector &values, const hist_vector &low_mask)
+	{
+		low = _mm_and_si128(values, low_mask);
+		high = _mm_and_si128(_mm_srli_epi16(values, 4), low_mask);
+	}
+	TARGET_SSE2 static inline void count_equal(hist_vector &counters, const hist_vector &values, const hist_vector &key)
+	{
+		counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(values, key));
+	}
+	TARGET_SSE2 static inline int horizontal_sum(const hist_vector &counters)
+	{
+		__m128i half = _mm_sad_epu8(counters, _mm_setzero_si128());
+		return _mm_cvtsi128_si32(half) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(half, half));
+	}
+};
+#endif
+
+/**
+ * Function compute_bin_lut prepares the lookup table value -> bin. The binning is the same as calcHist
+ * uses for 8-bit images with uniform ranges, so histograms counted with the table are identical
+ * to the calcHist ones.
+ *
+ * \bins amount of bins in histogram
+ * \range the range of histogram values
+ * \lut output table, values out of range are mapped to 'bins'
+ */
+void tracker::compute_bin_lut(int bins, const float range[2], uchar lut[256])
+{
+	double a = bins/((double)range[1] - range[0]);
+	double b = -a*range[0];
+	for (int value = 0; value < 256; value++){
+		int idx = cvFloor(value*a + b);
+		lut[value] = (idx >= 0 && idx < bins) ? (uchar)idx : (uchar)bins;
+	}
+}
+
+/**
+ * Function counts_to_histogram maps bins counts to the histogram Mat (bins x 1, CV_32F), the same
+ * which calcHist computes, and normalizes it like calculate_histogram does
+ *
+ * \counts bins counts
+ * \bins amount of bins in histogram
+ * \normalization tells, if histogram should be normalized
+ * \hist output histogram
+ */
+void tracker::counts_to_histogram(const int * counts, int bins, bool normalization, Mat &hist)
+{
+	hist.create(bins, 1, CV_32F);
+	for (int b = 0; b < bins; b++){
+		hist.at<float>(b) = (float)counts[b];
+	}
+	// normalizing histogram
+	if (normalization){
+		normalize( hist, hist, 0.01, 1, NORM_MINMAX, -1, Mat() );
+	}
+}
+
+// bins counts, for which the scoring loop is instantiated
+static const struct {
+	int bins;
+	HistogramScorer scorer;
+} histogram_scorers[] = {
+	{3, score_histogram<3>},
+	{8, score_histogram<8>},
+	{9, score_histogram<9>},
+	{10, score_histogram<10>},
+	{16, score_histogram<16>},
+	{32, score_histogram<32>},
+};
+
+/**
+ * Function find_histogram_scorer looks up the scoring loop instantiated for the bins count
+ *
+ * \bins amount of bins in histogram
+ *
+ * \return scoring function, or 0 if the bins count has no instantiation
+ */
+HistogramScorer tracker::find_histogram_scorer(int bins)
+{
+	for (size_t i = 0; i < sizeof(histogram_scorers)/sizeof(histogram_scorers[0]); i++){
+		if (histogram_scorers[i].bins == bins){
+			return histogram_scorers[i].scorer;
+		}
+	}
+	return 0;
+}
+
+// constructor
+BinPlane::BinPlane(void)
+{
+	packed = false;
+	bins_param = 0;
+}
+
+/**
+ * Function configure prepares the lookup table value -> bin, so the float range math is done
+ * only once per track, not for every pixel of every candidate. Bins indexes are packed
+ * to 4 bits when they fit (bins <= 16 and no value of the channel falls out of range).
+ *
+ * \bins amount of bins in histogram
+ * \range the range of histogram values
+ */
+void BinPlane::configure(int bins, const float range[2])
+{
+	bins_param = bins;
+	compute_bin_lut(bins, range, lut);
+
+	// the out of range index ('bins') has to fit to 4 bits as well, unless no value falls out of range
+	packed = bins < 16;
+	if (bins == 16){
+		packed = true;
+		for (int value = 0; value < 256; value++){
+			if (lut[value] == bins) packed = false;
+		}
+	}
+}
+
+/**
+ * Function quantize maps every pixel of the region of channel image to its bin. The plane is computed
+ * once per frame and shared by all histogram consumers. It has the size of the whole frame
+ * (allocated once), but only the region is filled in.
+ *
+ * \channel_frame frame with already extracted channel of interest
+ * \region part of the frame to quantize (e.g. the search region)
+ */
+void BinPlane::quantize(const Mat &channel_frame, Rect region)
+{
+	size = channel_frame.size();
+	region &= Rect(Point(0, 0), size);
+	if (!packed){
+		data.create(size, CV_8U);
+		for (int y = region.y; y < region.y + region.height; y++){
+			const uchar * pixel = channel_frame.ptr<uchar>(y);
+			uchar * bin = data.ptr<uchar>(y);
+			for (int x = region.x; x < region.x + region.width; x++){
+				bin[x] = lut[pixel[x]];
+			}
+		}
+		return;
+	}
+	// two pixels per byte, the even one in lower 4 bits (region starts at even pixel)
+	data.create(size.height, (size.width + 1)/2, CV_8U);
+	int x_from = region.x & ~1;
+	int x_to = region.x + region.width;
+	for (int y = region.y; y < region.y + region.height; y++){
+		const uchar * pixel = channel_frame.ptr<uchar>(y);
+		uchar * bin = data.ptr<uchar>(y);
+		int x = x_from;
+		for (; x + 1 < x_to; x += 2){
+			bin[x >> 1] = (uchar)(lut[pixel[x]] | (lut[pixel[x + 1]] << 4));
+		}
+		if (x < x_to){
+			bin[x >> 1] = (uchar)((bin[x >> 1] & 0xF0) | lut[pixel[x]]);
+		}
+	}
+}
+
+/**
+ * Function unpack_row writes bins of the pixels [x_from, x_to) of the row y to out
+ */
+void BinPlane::unpack_row(int y, int x_from, int x_to, uchar * out) const
+{
+	const uchar * row = data.ptr<uchar>(y);
+	if (!packed){
+		memcpy(out, row + x_from, x_to - x_from);
+		return;
+	}
+	for (int x = x_from; x < x_to; x++){
+		*out++ = (row[x >> 1] >> ((x & 1) << 2)) & 15;
+	}
+}
+
+/**
+ * Function count adds (sign 1) or removes (sign -1) pixels of the columns [x_from, x_to)
+ * and rows [y, y + height) to the histogram
+ */
+void BinPlane::count(int x_from, int x_to, int y, int height, int sign, int * hist) const
+{
+	for (int row_idx = y; row_idx < y + height; row_idx++){
+		const uchar * row = data.ptr<uchar>(row_idx);
+		if (!packed){
+			for (int x = x_from; x < x_to; x++){
+				hist[row[x]] += sign;
+			}
+			continue;
+		}
+		int x = x_from;
+		// odd first pixel, then whole bytes, then even last pixel
+		if (x < x_to && (x & 1)){
+			hist[row[x >> 1] >> 4] += sign;
+			x++;
+		}
+		for (; x + 1 < x_to; x += 2){
+			uchar pair = row[x >> 1];
+			hist[pair & 15] += sign;
+			hist[pair >> 4] += sign;
+		}
+		if (x < x_to){
+			hist[row[x >> 1] & 15] += sign;
+		}
+	}
+}
+
+#ifdef HIST_X86_KERNELS
+/**
+ * Function count_compare counts bins (up to 16) of the rectangle with hist_vector compares: every bin has its own
+ * hist_vector of 8-bit counters, incremented by the compare masks and flushed before they can overflow.
+ * Works for packed planes as well (both 4-bit halves of the byte are compared).
+ * It is instantiated for the hist_vector operations of the instruction set inside the function compiled for it.
+ */
+template <class Ops> static inline __attribute__((always_inline)) void count_compare(const BinPlane &bins_plane, Rect rectangle, int * out)
+{
+	typedef typename Ops::hist_vector hist_vector;
+	int bins = bins_plane.bins_param;
+	hist_vector counters[16], keys[16];
+	for (int b = 0; b < bins; b++){
+		Ops::zero(counters[b]);
+		Ops::set1(keys[b], b);
+	}
+	hist_vector low_mask;
+	Ops::set1(low_mask, 15);
+	// every iteration adds at most 1 (or 2 if packed) to the 8-bit counter
+	int limit = bins_plane.packed ? 127 : 255;
+	int iterations = 0;
+
+	for (int y = rectangle.y; y < rectangle.y + rectangle.height; y++){
+		const uchar * row = bins_plane.data.ptr<uchar>(y);
+		int x = rectangle.x;
+		int x_end = rectangle.x + rectangle.width;
+		const uchar * bytes;
+		int len;
+		if (bins_plane.packed){
+			// odd first pixel and even last pixel do not fill a whole byte
+			if (x < x_end && (x & 1)){
+				out[row[x >> 1] >> 4]++;
+				x++;
+			}
+			if ((x_end - x) & 1){
+				out[row[(x_end - 1) >> 1] & 15]++;
+			}
+			bytes = row + (x >> 1);
+			len = (x_end - x) >> 1;
+		} else {
+			bytes = row + x;
+			len = x_end - x;
+		}
+
+		int i = 0;
+		for (; i + Ops::size <= len; i += Ops::size){
+			hist_vector values;
+			Ops::load(values, bytes + i);
+			if (bins_plane.packed){
+				hist_vector low, high;
+				Ops::split(low, high, values, low_mask);
+				for (int b = 0; b < bins; b++){
+					Ops::count_equal(counters[b], low, keys[b]);
+					Ops::count_equal(counters[b], high, keys[b]);
+				}
+			} else {
+				for (int b = 0; b < bins; b++){
+					Ops::count_equal(counters[b], values, keys[b]);
+				}
+			}
+			if (++iterations == limit){
+				for (int b = 0; b < bins; b++){
+					out[b] += Ops::horizontal_sum(counters[b]);
+					Ops::zero(counters[b]);
+				}
+				iterations = 0;
+			}
+		}
+		// the rest of the row
+		for (; i < len; i++){
+			if (bins_plane.packed){
+				out[bytes[i] & 15]++;
+				out[bytes[i] >> 4]++;
+			} else {
+				out[bytes[i]]++;
+			}
+		}
+	}
+	for (int b = 0; b < bins; b++){
+		out[b] += Ops::horizontal_sum(counters[b]);
+	}
+}
+
+// counting kernel compiled for AVX2 (called only if the CPU supports it)
+TARGET_AVX2 static void count_compare_avx2(const BinPlane &bins_plane, Rect rectangle, int * out)
+{
+	count_compare<HistAvx2>(bins_plane, rectangle, out);
+}
+
+// counting kernel compiled for SSE2
+TARGET_SSE2 static void count_compare_sse2(const BinPlane &bins_plane, Rect rectangle, int * out)
+{
+	count_compare<HistSse2>(bins_plane, rectangle, out);
+}
+#endif
+
+/**
+ * Function count_subhistograms counts bins of the rectangle (not packed plane) into 4 interleaved sub-histograms,
+ * so consecutive pixels of the same bin do not wait for each other's store, then sums them up
+ */
+static void count_subhistograms(const BinPlane &bins_plane, Rect rectangle, int * out)
+{
+	int bins = bins_plane.bins_param;
+	int sub[4][257];
+	for (int k = 0; k < 4; k++){
+		memset(sub[k], 0, (bins + 1)*sizeof(int));
+	}
+	for (int y = rectangle.y; y < rectangle.y + rectangle.height; y++){
+		const uchar * pixel = bins_plane.data.ptr<uchar>(y) + rectangle.x;
+		int x = 0;
+		for (; x + 4 <= rectangle.width; x += 4){
+			sub[0][pixel[x]]++;
+			sub[1][pixel[x + 1]]++;
+			sub[2][pixel[x + 2]]++;
+			sub[3][pixel[x + 3]]++;
+		}
+		for (; x < rectangle.width; x++){
+			sub[0][pixel[x]]++;
+		}
+	}
+	for (int b = 0; b <= bins; b++){
+		out[b] = sub[0][b] + sub[1][b] + sub[2][b] + sub[3][b];
+	}
+}
+
+/**
+ * Function count_histogram is the counting kernel of single channel 8-bit plane of bins indexes, which replaces
+ * calcHist for small rectangles (no argument validation, allocation nor float output). Up to 16 bins it compares
+ * whole vectors (AVX2 or SSE2, chosen by the CPU at run time), otherwise it uses 4 sub-histograms.
+ *
+ * \bins_plane quantized frame
+ * \rectangle rectangle in frame coordinates
+ * \out caller buffer for counts, bins + 1 values (the last one gathers values out of range)
+ */
+void tracker::count_histogram(const BinPlane &bins_plane, Rect rectangle, int * out)
+{
+	int bins = bins_plane.bins_param;
+	memset(out, 0, (bins + 1)*sizeof(int));
+#ifdef HIST_X86_KERNELS
+	if (bins <= 16 && (__builtin_cpu_supports("avx2") || __builtin_cpu_supports("sse2"))){
+		if (__builtin_cpu_supports("avx2")){
+			count_compare_avx2(bins_plane, rectangle, out);
+		} else {
+			count_compare_sse2(bins_plane, rectangle, out);
+		}
+		out[bins] = rectangle.area();
+		for (int b = 0; b < bins; b++){
+			out[bins] -= out[b];
+		}
+		return;
+	}
+#endif
+	if (bins_plane.packed){
+		bins_plane.count(rectangle.x, rectangle.x + rectangle.width, rectangle.y, rectangle.height, 1, out);
+	} else {
+		count_subhistograms(bins_plane, rectangle, out);
+	}
+}
+
+/**
+ * Function sliding_window_histograms computes histograms of all candidates, walking the candidates grid
+ * row by row (in the style of Huang's constant-time filters). When the window moves by p_stride pixels
+ * the running histogram is updated by adding the entering columns and removing the leaving ones,
+ * thus every candidate costs O(stride x height) instead of O(width x height), without any per frame table.
+ *
+ * \bins_plane quantized frame
+ * \candidates vector of candidates (generate_candidates lays them on regular grid)
+ * \counts output counts, candidates.size() x bins values in candidates order
+ */
+template <typename T>
+void tracker::sliding_window_histograms(const BinPlane &bins_plane, const vector<Rect> &candidates, vector<T> &counts)
+{
+	int bins = bins_plane.bins_param;
+	counts.assign(candidates.size()*bins, 0);
+
+	// visiting candidates row by row, from left to right
+	vector<int> order(candidates.size());
+	for (int i = 0; i < (int)order.size(); i++){
+		order[i] = i;
+	}
+	sort(order.begin(), order.end(), [&candidates](int a, int b) {
+		const Rect &ra = candidates[a];
+		const Rect &rb = candidates[b];
+		if (ra.y != rb.y) return ra.y < rb.y;
+		if (ra.height != rb.height) return ra.height < rb.height;
+		if (ra.width != rb.width) return ra.width < rb.width;
+		return ra.x < rb.x;
+	});
+
+	// running histogram (last bin gathers values out of range)
+	vector<int> hist(bins + 1);
+	Rect previous;
+	for (int k = 0; k < (int)order.size(); k++){
+		const Rect &window = candidates[order[k]];
+		int dx = window.x - previous.x;
+		bool same_row = k > 0 && window.y == previous.y && window.height == previous.height && window.width == previous.width;
+
+		if (same_row && dx >= 0 && dx < window.width){
+			// removing leaving columns and adding entering ones
+			bins_plane.count(previous.x, window.x, window.y, window.height, -1, hist.data());
+			bins_plane.count(previous.x + previous.width, window.x + window.width, window.y, window.height, 1, hist.data());
+		} else {
+			// first window of the row (or far jump) is counted from scratch
+			fill(hist.begin(), hist.end(), 0);
+			bins_plane.count(window.x, window.x + window.width, window.y, window.height, 1, hist.data());
+		}
+		copy(hist.begin(), hist.begin() + bins, counts.begin() + (size_t)order[k]*bins);
+		previous = window;
+	}
+}
+
+template void tracker::sliding_window_histograms<int>(const BinPlane &, const vector<Rect> &, vector<int> &);
+template void tracker::sliding_window_histograms<ushort>(const BinPlane &, const vector<Rect> &, vector<ushort> &);
+
+// constructor
+BoundedBhattacharyya::BoundedBhattacharyya(void)
+{
+	bins_param = 0;
+	candidates = 0;
+	abandoned = 0;
+	bins = 0;
+	skipped_bins = 0;
+}
+
+/**
+ * Function set_template keeps values of the template histogram and sums of its remaining bins
+ *
+ * \gt_hist template histogram (bins x 1, CV_32F)
+ */
+void BoundedBhattacharyya::set_template(const Mat &gt_hist)
+{
+	bins_param = (int)gt_hist.total();
+	gt_bins.assign(gt_hist.ptr<float>(), gt_hist.ptr<float>() + bins_param);
+	gt_remaining.assign(bins_param + 1, 0.);
+	for (int b = bins_param - 1; b >= 0; b--){
+		gt_remaining[b] = gt_remaining[b + 1] + gt_bins[b];
+	}
+	candidate_bins.resize(bins_param);
+}
+
+/**
+ * Function distance computes Bhattacharyya distance as compareHist(..., CV_COMP_BHATTACHARYYA) does, but stops
+ * summing the coefficient once the sum of the bins so far plus the Cauchy-Schwarz bound of the remaining bins
+ * cannot exceed the coefficient of the best distance (the distance would be larger than best)
+ *
+ * \values candidate histogram, bins_param values
+ * \best smallest distance of the candidates of the frame scored so far (DBL_MAX if none)
+ *
+ * \return distance, or DBL_MAX if the candidate was abandoned
+ */
+double BoundedBhattacharyya::distance(const float * values, double best)
+{
+	double s1 = gt_remaining[0], s2 = 0;
+	for (int b = 0; b < bins_param; b++){
+		s2 += values[b];
+	}
+	double scale = fabs(s1*s2) > FLT_EPSILON ? 1./std::sqrt(s1*s2) : 1.;
+	// coefficient, which the candidate has to exceed to have distance not above best
+	double needed = (1. - best*best)/scale;
+	candidates++;
+	bins += bins_param;
+
+	double coefficient = 0, remaining = s2;
+	for (int b = 0; b < bins_param; b++){
+		double a = gt_bins[b], c = values[b];
+		coefficient += std::sqrt(a*c);
+		remaining -= c;
+		double missing = needed - coefficient;
+		if (b < bins_param - 1 && missing > 0 && missing*missing > gt_remaining[b + 1]*std::max(remaining, 0.)){
+			abandoned++;
+			skipped_bins += bins_param - 1 - b;
+			return DBL_MAX;
+		}
+	}
+	return std::sqrt(std::max(1. - coefficient*scale, 0.));
+}
+
+/**
+ * Function distance_of_counts builds the candidate histogram from counts (like Histogram::from_counts) and scores it
+ */
+double BoundedBhattacharyya::distance_of_counts(const int * counts, bool normalization, double best)
+{
+	float scale = 1, shift = 0;
+	if (normalization){
+		minmax_scale(counts, bins_param, scale, shift);
+	}
+	for (int b = 0; b < bins_param; b++){
+		candidate_bins[b] = normalization ? (float)counts[b]*scale + shift : (float)counts[b];
+	}
+	return distance(&candidate_bins[0], best);
+}
+
+// constructor
+IntegralHistogram::IntegralHistogram(void)
+{
+	bins_param = 0;
+}
+
+/**
+ * Function build computes integral histogram of the quantized frame over the search region.
+ * Every entry (y, x) keeps the bins counts of rectangle from region's top left corner to (y, x),
+ * thus any rectangle histogram inside the region takes 4 lookups per bin.
+ *
+ * \bins_plane quantized frame
+ * \search_region region of the frame, over which integral histogram is built
+ */
+void IntegralHistogram::build(const BinPlane &bins_plane, Rect search_region)
+{
+	region = search_region & Rect(Point(0, 0), bins_plane.size);
+	bins_param = bins_plane.bins_param;
+	int bins = bins_param;
+
+	int row_len = (region.width + 1)*bins;
+	table.assign((size_t)(region.height + 1)*row_len, 0);
+	vector<int> row_counts(bins + 1);
+	vector<uchar> row_bins(region.width);
+
+	for (int y = 0; y < region.height; y++){
+		bins_plane.unpack_row(region.y + y, region.x, region.x + region.width, row_bins.data());
+		const int * above = &table[(size_t)y*row_len + bins];
+		int * current = &table[(size_t)(y + 1)*row_len + bins];
+		fill(row_counts.begin(), row_counts.end(), 0);
+		// cumulating counts of the row and adding counts of rows above
+		for (int x = 0; x < region.width; x++){
+			row_counts[row_bins[x]]++;
+			for (int b = 0; b < bins; b++){
+				current[b] = above[b] + row_counts[b];
+			}
+			above += bins;
+			current += bins;
+		}
+	}
+}
+/**
+ * Function covers tells if the rectangle lies inside the region of integral histogram
+ */
+bool IntegralHistogram::covers(Rect rectangle) const
+{
+	return !table.empty() && (rectangle & region) == rectangle;
+}
+
+/**
+ * Function query writes histogram of the rectangle (as bins counts) to out
+ *
+ * \rectangle rectangle inside the region, in frame coordinates
+ * \out output counts, bins_param values
+ */
+void IntegralHistogram::query(Rect rectangle, int * out) const
+{
+	int row_len = (region.width + 1)*bins_param;
+	int x0 = (rectangle.x - region.x)*bins_param;
+	int x1 = x0 + rectangle.width*bins_param;
+	const int * top = &table[(size_t)(rectangle.y - region.y)*row_len];
+	const int * bottom = top + (size_t)rectangle.height*row_len;
+	for (int b = 0; b < bins_param; b++){
+		out[b] = bottom[x1 + b] - bottom[x0 + b] - top[x1 + b] + top[x0 + b];
+	}
+}
+
+// constructor
+LikelihoodMap::LikelihoodMap(void)
+{
+	bins_param = 0;
+	max_weight = 0;
+}
+
+/**
+ * Function set_template computes the weight of every bin as log-ratio of its probability in the object and
+ * in the background (counts smoothed by one, so bins empty in either of them get finite weights)
+ *
+ * \object_counts bins counts of the object (ground truth rectangle of the first frame)
+ * \background_counts bins counts around the object (search region of the first frame without the object)
+ * \bins amount of bins in histogram
+ */
+void LikelihoodMap::set_template(const int * object_counts, const int * background_counts, int bins)
+{
+	bins_param = bins;
+	double object_sum = bins, background_sum = bins;
+	for (int b = 0; b < bins; b++){
+		object_sum += object_counts[b];
+		background_sum += std::max(background_counts[b], 0);
+	}
+	weights.assign(bins + 1, 0);
+	max_weight = 0;
+	for (int b = 0; b < bins; b++){
+		double p_object = (object_counts[b] + 1)/object_sum;
+		double p_background = (std::max(background_counts[b], 0) + 1)/background_sum;
+		weights[b] = std::log(p_object/p_background);
+		max_weight = std::max(max_weight, weights[b]);
+	}
+}
+
+/**
+ * Function build computes integral image of bins weights of the quantized frame over the search region.
+ * Every entry (y, x) keeps the sum of weights of rectangle from region's top left corner to (y, x).
+ *
+ * \bins_plane quantized frame
+ * \search_region region of the frame, over which integral image is built
+ */
+void LikelihoodMap::build(const BinPlane &bins_plane, Rect search_region)
+{
+	region = search_region & Rect(Point(0, 0), bins_plane.size);
+	int row_len = region.width + 1;
+	table.assign((size_t)(region.height + 1)*row_len, 0);
+	vector<uchar> row_bins(region.width);
+
+	for (int y = 0; y < region.height; y++){
+		bins_plane.unpack_row(region.y + y, region.x, region.x + region.width, row_bins.data());
+		const double * above = &table[(size_t)y*row_len + 1];
+		double * current = &table[(size_t)(y + 1)*row_len + 1];
+		double row_sum = 0;
+		// cumulating weights of the row and adding sums of rows above
+		for (int x = 0; x < region.width; x++){
+			row_sum += weights[row_bins[x]];
+			current[x] = above[x] + row_sum;
+		}
+	}
+}
+
+/**
+ * Function score computes distances of all candidates from the integral image built for the frame (build),
+ * which is built again over the union of the region and the candidates only if some of them lie out of it
+ *
+ * \bins_plane quantized frame
+ * \candidates vector of candidates
+ *
+ * \return distances of candidates (lower means more object-like pixels), in candidates order
+ */
+const vector<float> & LikelihoodMap::score(const BinPlane &bins_plane, const vector<Rect> &candidates)
+{
+	scores.resize(candidates.size());
+	if (candidates.empty()){
+		return scores;
+	}
+	Rect candidates_region = candidates[0];
+	for (size_t i = 1; i < candidates.size(); i++){
+		candidates_region |= candidates[i];
+	}
+	if ((candidates_region & region) != candidates_region){
+		build(bins_plane, candidates_region | region);
+	}
+	for (size_t i = 0; i < candidates.size(); i++){
+		scores[i] = (float)distance(candidates[i]);
+	}
+	return scores;
+}
+
+// constructor
+BatchBhattacharyya::BatchBhattacharyya(void)
+{
+	bins_param = 0;
+	stride = 0;
+}
+
+/**
+ * Function set_template precomputes the square roots of the template histogram divided by its sum,
+ * so Bhattacharyya coefficient of a candidate takes one multiplication per bin
+ *
+ * \gt_hist template histogram (bins x 1, CV_32F, already normalized if demanded)
+ */
+void BatchBhattacharyya::set_template(const Mat &gt_hist)
+{
+	bins_param = (int)gt_hist.total();
+	double gt_sum = 0;
+	for (int b = 0; b < bins_param; b++){
+		gt_sum += gt_hist.at<float>(b);
+	}
+	gt_sqrt.resize(bins_param);
+	for (int b = 0; b < bins_param; b++){
+		double value = gt_hist.at<float>(b);
+		gt_sqrt[b] = (float)std::sqrt(gt_sum > FLT_EPSILON ? value/gt_sum : value);
+	}
+}
+
+/**
+ * Function bhattacharyya_sums sums values and products of square roots with the template ones of candidates
+ * stored as structure of arrays, 8 candidates at once
+ *
+ * \values bins rows of stride values (stride is a multiple of 8)
+ * \gt_sqrt square roots of the template histogram divided by its sum
+ * \sums output sums of candidates histograms, stride values
+ * \coefficients output unnormalized Bhattacharyya coefficients, stride values
+ */
+static void bhattacharyya_sums(const float * values, int stride, int bins, const float * gt_sqrt, float * sums, float * coefficients)
+{
+	for (int i = 0; i < stride; i += 8){
+		float candidates_sum[8] = {0}, candidates_coefficient[8] = {0};
+		for (int b = 0; b < bins; b++){
+			const float * bin_values = &values[(size_t)b*stride + i];
+			for (int lane = 0; lane < 8; lane++){
+				candidates_sum[lane] += bin_values[lane];
+				candidates_coefficient[lane] += std::sqrt(bin_values[lane])*gt_sqrt[b];
+			}
+		}
+		for (int lane = 0; lane < 8; lane++){
+			sums[i + lane] = candidates_sum[lane];
+			coefficients[i + lane] = candidates_coefficient[lane];
+		}
+	}
+}
+
+#ifdef HIST_X86_KERNELS
+// bhattacharyya_sums compiled for AVX2 (called only if the CPU supports it)
+TARGET_AVX2 static void bhattacharyya_sums_avx2(const float * values, int stride, int bins, const float * gt_sqrt, float * sums, float * coefficients)
+{
+	for (int i = 0; i < stride; i += 8){
+		__m256 candidates_sum = _mm256_setzero_ps();
+		__m256 candidates_coefficient = _mm256_setzero_ps();
+		for (int b = 0; b < bins; b++){
+			__m256 bin_values = _mm256_loadu_ps(&values[(size_t)b*stride + i]);
+			candidates_sum = _mm256_add_ps(candidates_sum, bin_values);
+			candidates_coefficient = _mm256_add_ps(candidates_coefficient,
+					_mm256_mul_ps(_mm256_sqrt_ps(bin_values), _mm256_set1_ps(gt_sqrt[b])));
+		}
+		_mm256_storeu_ps(&sums[i], candidates_sum);
+		_mm256_storeu_ps(&coefficients[i], candidates_coefficient);
+	}
+}
+
+// bhattacharyya_sums compiled for SSE2, 4 candidates at once
+TARGET_SSE2 static void bhattacharyya_sums_sse2(const float * values, int stride, int bins, const float * gt_sqrt, float * sums, float * coefficients)
+{
+	for (int i = 0; i < stride; i += 4){
+		__m128 candidates_sum = _mm_setzero_ps();
+		__m128 candidates_coefficient = _mm_setzero_ps();
+		for (int b = 0; b < bins; b++){
+			__m128 bin_values = _mm_loadu_ps(&values[(size_t)b*stride + i]);
+			candidates_sum = _mm_add_ps(candidates_sum, bin_values);
+			candidates_coefficient = _mm_add_ps(candidates_coefficient,
+					_mm_mul_ps(_mm_sqrt_ps(bin_values), _mm_set1_ps(gt_sqrt[b])));
+		}
+		_mm_storeu_ps(&sums[i], candidates_sum);
+		_mm_storeu_ps(&coefficients[i], candidates_coefficient);
+	}
+}
+#endif
+
+/**
+ * Function score computes Bhattacharyya distances of all candidates to the template, the same value
+ * compareHist(..., CV_COMP_BHATTACHARYYA) returns (up to float rounding). Counts are transposed to the
+ * structure of arrays and normalized (NORM_MINMAX to [0.01, 1], like calculate_histogram does) in the same pass.
+ *
+ * \counts bins counts of candidates, bins_param values per candidate
+ * \amount amount of candidates
+ * \normalization tells, if histograms should be normalized
+ */
+const vector<float> & BatchBhattacharyya::score(const int * counts, int amount, bool normalization)
+{
+	stride = (amount + 7) & ~7;
+	candidates_values.resize((size_t)bins_param*stride);
+	sums.resize(stride);
+	coefficients.resize(stride);
+	scores.resize(amount);
+
+	// transposing counts to the structure of arrays, fused with normalization
+	for (int i = 0; i < stride; i++){
+		float scale = 1, shift = 0;
+		if (i >= amount){
+			// padding candidates
+			scale = 0;
+		} else if (normalization){
+			minmax_scale(counts + (size_t)i*bins_param, bins_param, scale, shift);
+		}
+		for (int b = 0; b < bins_param; b++){
+			int count = i < amount ? counts[(size_t)i*bins_param + b] : 0;
+			candidates_values[(size_t)b*stride + i] = (float)count*scale + shift;
+		}
+	}
+
+	// one pass over all bins of all candidates, 8 candidates at once
+#ifdef HIST_X86_KERNELS
+	if (__builtin_cpu_supports("avx2")){
+		bhattacharyya_sums_avx2(candidates_values.data(), stride, bins_param, gt_sqrt.data(), sums.data(), coefficients.data());
+	} else if (__builtin_cpu_supports("sse2")){
+		bhattacharyya_sums_sse2(candidates_values.data(), stride, bins_param, gt_sqrt.data(), sums.data(), coefficients.data());
+	} else {
+		bhattacharyya_sums(candidates_values.data(), stride, bins_param, gt_sqrt.data(), sums.data(), coefficients.data());
+	}
+#else
+	bhattacharyya_sums(candidates_values.data(), stride, bins_param, gt_sqrt.data(), sums.data(), coefficients.data());
+#endif
+
+	// distances
+	for (int i = 0; i < amount; i++){
+		float coefficient = sums[i] > FLT_EPSILON ? coefficients[i]/std::sqrt(sums[i]) : coefficients[i];
+		scores[i] = std::sqrt(std::max(1.f - coefficient, 0.f));
+	}
+	return scores;
+}
+
+// constructor
+HellingerEmbedding::HellingerEmbedding(void)
+{
+	bins_param = 0;
+}
+
+/**
+ * Function set_template embeds the template histogram as sqrt(gt_hist/sum(gt_hist))
+ *
+ * \gt_hist template histogram (bins x 1, CV_32F, already normalized if demanded)
+ */
+void HellingerEmbedding::set_template(const Mat &gt_hist)
+{
+	bins_param = (int)gt_hist.total();
+	double gt_sum = 0;
+	for (int b = 0; b < bins_param; b++){
+		gt_sum += gt_hist.at<float>(b);
+	}
+	gt_embedded.create(bins_param, 1, CV_32F);
+	for (int b = 0; b < bins_param; b++){
+		double value = gt_hist.at<float>(b);
+		gt_embedded.at<float>(b) = (float)std::sqrt(gt_sum > FLT_EPSILON ? value/gt_sum : value);
+	}
+}
+
+/**
+ * Function score embeds every candidate histogram (normalized like calculate_histogram does) as sqrt(h/sum(h))
+ * into a row of candidates_embedded, and computes all Bhattacharyya coefficients with one gemm against
+ * the embedded template. Distances are the same compareHist returns (up to float rounding).
+ *
+ * \counts bins counts of candidates, bins_param values per candidate
+ * \amount amount of candidates
+ * \normalization tells, if histograms should be normalized
+ */
+const vector<float> & HellingerEmbedding::score(const int * counts, int amount, bool normalization)
+{
+	scores.resize(amount);
+	if (amount == 0){
+		return scores;
+	}
+
+	// embedding candidates
+	candidates_embedded.create(amount, bins_param, CV_32F);
+	for (int i = 0; i < amount; i++){
+		const int * candidate = counts + (size_t)i*bins_param;
+		float * row = candidates_embedded.ptr<float>(i);
+		float scale = 1, shift = 0;
+		if (normalization){
+			minmax_scale(candidate, bins_param, scale, shift);
+		}
+		double candidate_sum = 0;
+		for (int b = 0; b < bins_param; b++){
+			row[b] = (float)candidate[b]*scale + shift;
+			candidate_sum += row[b];
+		}
+		float inverse_sum = candidate_sum > FLT_EPSILON ? (float)(1./candidate_sum) : 1.f;
+		for (int b = 0; b < bins_param; b++){
+			row[b] = std::sqrt(row[b]*inverse_sum);
+		}
+	}
+
+	// all coefficients with one matrix-vector product
+	gemm(candidates_embedded, gt_embedded, 1, Mat(), 0, coefficients);
+
+	// distances
+	for (int i = 0; i < amount; i++){
+		scores[i] = std::sqrt(std::max(1.f - coefficients.at<float>(i), 0.f));
+	}
+	return scores;
+}
+
+// constructor
+IntegerBhattacharyya::IntegerBhattacharyya(void)
+{
+	bins_param = 0;
+	lut_area = -1;
+	lut_normalization = false;
+}
+
+/**
+ * Function set_template precomputes the square roots of the template histogram divided by its sum,
+ * as fixed point numbers with 16 fractional bits
+ *
+ * \gt_hist template histogram (bins x 1, CV_32F, already normalized if demanded)
+ */
+void IntegerBhattacharyya::set_template(const Mat &gt_hist)
+{
+	bins_param = (int)gt_hist.total();
+	double gt_sum = 0;
+	for (int b = 0; b < bins_param; b++){
+		gt_sum += gt_hist.at<float>(b);
+	}
+	gt_fixed.resize(bins_param);
+	for (int b = 0; b < bins_param; b++){
+		double value = gt_hist.at<float>(b);
+		gt_fixed[b] = (uint32_t)cvRound(std::sqrt(gt_sum > FLT_EPSILON ? value/gt_sum : value)*65536);
+	}
+}
+
+/**
+ * Function prepare builds the lookup table of square roots (16 fractional bits) for candidates of the area.
+ * Without normalization it is indexed by the count itself (area + 1 values). With normalization (NORM_MINMAX
+ * to [0.01, 1]) a bin is (99*(count - min) + (max - min))/(100*(max - min)); the denominator is common to all bins
+ * and cancels out of the Bhattacharyya coefficient, so the table is indexed by the integer numerator (100*area + 1 values).
+ *
+ * \area area of the candidates rectangles
+ * \normalization tells, if histograms are normalized
+ */
+void IntegerBhattacharyya::prepare(int area, bool normalization)
+{
+	if (area == lut_area && normalization == lut_normalization){
+		return;
+	}
+	lut_area = area;
+	lut_normalization = normalization;
+	int size = (normalization ? 100*area : area) + 1;
+	sqrt_lut.resize(size);
+	for (int n = 0; n < size; n++){
+		sqrt_lut[n] = (uint32_t)cvRound(std::sqrt((double)n)*65536);
+	}
+}
+
+/**
+ * Function score computes Bhattacharyya distances of all candidates to the template without float histograms:
+ * per bin it takes one table lookup and one integer multiply-add, the only square root per candidate is the one
+ * of the histogram sum. Distances are the same compareHist returns for the normalized float histograms
+ * (up to fixed point rounding, far below the differences between grid neighbours), so the argmin is preserved.
+ *
+ * \counts bins counts of candidates, bins_param values per candidate
+ * \amount amount of candidates
+ * \area area of the candidates rectangles (bounds every count)
+ * \normalization tells, if histograms should be normalized
+ */
+template <typename T>
+const vector<float> & IntegerBhattacharyya::score(const T * counts, int amount, int area, bool normalization)
+{
+	prepare(area, normalization);
+	scores.resize(amount);
+	const uint32_t * lut = sqrt_lut.data();
+
+	for (int i = 0; i < amount; i++){
+		const T * candidate = counts + (size_t)i*bins_param;
+		int offset = 0, factor = 1, spread = 0;
+		if (normalization){
+			int min_count = candidate[0], max_count = candidate[0];
+			for (int b = 1; b < bins_param; b++){
+				min_count = std::min(min_count, (int)candidate[b]);
+				max_count = std::max(max_count, (int)candidate[b]);
+			}
+			// flat histogram is normalized to 0.01 in every bin
+			spread = max_count - min_count;
+			factor = spread > 0 ? 99 : 0;
+			offset = min_count;
+			spread = spread > 0 ? spread : 1;
+		}
+		uint64_t coefficient = 0;
+		uint64_t sum = 0;
+		for (int b = 0; b < bins_param; b++){
+			uint32_t index = (uint32_t)(factor*((int)candidate[b] - offset) + spread);
+			sum += index;
+			coefficient += (uint64_t)gt_fixed[b]*lut[index];
+		}
+		// both factors have 16 fractional bits
+		double bc = sum > 0 ? (double)coefficient/(65536.*65536.*std::sqrt((double)sum)) : 0;
+		scores[i] = (float)std::sqrt(std::max(1. - bc, 0.));
+	}
+	return scores;
+}
+
+template const vector<float> & IntegerBhattacharyya::score<int>(const int *, int, int, bool);
+template const vector<float> & IntegerBhattacharyya::score<ushort>(const ushort *, int, int, bool);
@@ -0,0 +1,346 @@
+/* Applied Video Sequence Analysis (AVSA)
+ *
+ *	LAB4: HistogramEngine
+ *	HistogramEngine.hpp
+ *
+ * 	Authors: Sergio Romero & Jan Sieradzki
+ *	VPULab-UAM 2020
+ */
+
+
+#include <opencv2/opencv.hpp>
+#ifndef HistogramEngine_HPP_INCLUDE
+#define HistogramEngine_HPP_INCLUDE
+
+#include <array>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+
+using namespace cv;
+using namespace std;
+
+namespace tracker {
+
+	// fills lut with the bin of every 8-bit value, exactly as calcHist bins it for uniform ranges
+	// (values out of the range are mapped to 'bins', which is never counted; bins must be lower than 256)
+	void compute_bin_lut(int bins, const float range[2], uchar lut[256]);
+
+	// converts bins counts into the histogram Mat in the same format calcHist returns it (bins x 1, CV_32F)
+	void counts_to_histogram(const int * counts, int bins, bool normalization, Mat &hist);
+
+	//class
+	class BinPlane{
+	//Public functions
+	public:
+		//constructor function
+		BinPlane(void);
+
+		//prepares lookup table value -> bin (done once per track)
+		void configure(int bins, const float range[2]);
+
+		//maps every pixel of the region of channel image to its bin (done once per frame)
+		void quantize(const Mat &channel_frame, Rect region);
+
+		//bin of the pixel
+		inline int at(int y, int x) const
+		{
+			const uchar * row = data.ptr<uchar>(y);
+			return packed ? (row[x >> 1] >> ((x & 1) << 2)) & 15 : row[x];
+		}
+
+		//writes bins of the pixels [x_from, x_to) of the row y to out
+		void unpack_row(int y, int x_from, int x_to, uchar * out) const;
+
+		//adds (sign 1) or removes (sign -1) pixels [x_from, x_to) of the rows [y, y + height) to hist
+		//(hist has bins_param + 1 values, the last one gathers values out of range)
+		void count(int x_from, int x_to, int y, int height, int sign, int * hist) const;
+
+		// bins indexes of the pixels (two pixels per byte if packed)
+		Mat data;
+		// size of the quantized image
+		Size size;
+		// tells if bins indexes are packed to 4 bits
+		bool packed;
+		// amount of bins in histogram
+		int bins_param;
+		// lookup table value -> bin
+		uchar lut[256];
+	};
+
+	// counting kernel (AVX2/SSE2 chosen at run time) writing bins counts of the rectangle to the caller buffer
+	// (out has bins + 1 values, the last one gathers values out of range)
+	void count_histogram(const BinPlane &bins_plane, Rect rectangle, int * out);
+
+	// computes bins counts of all candidates (of the same size) with one running histogram sliding along the grid rows
+	// (counts are written in candidates order, bins values per candidate; instantiated for int and ushort counts)
+	template <typename T>
+	void sliding_window_histograms(const BinPlane &bins_plane, const vector<Rect> &candidates, vector<T> &counts);
+
+	// scale and shift, which normalize (NORM_MINMAX to [0.01, 1]) computes for CV_32F histogram of the counts
+	inline void minmax_scale(const int * counts, int bins, float &scale, float &shift)
+	{
+		int min_count = counts[0], max_count = counts[0];
+		for (int b = 1; b < bins; b++){
+			min_count = std::min(min_count, counts[b]);
+			max_count = std::max(max_count, counts[b]);
+		}
+		double smin = min_count, smax = max_count;
+		scale = (float)((1 - 0.01)*(smax - smin > DBL_EPSILON ? 1./(smax - smin) : 0));
+		shift = (float)0.01 - (float)(smin*scale);
+	}
+
+	//class
+	// histogram with the bins count known at compile time, bins are kept inline (no allocations),
+	// so loops over them are fully unrolled
+	template <int N>
+	class Histogram{
+	//Public functions
+	public:
+		//fills bins with counts, normalized like calculate_histogram does (NORM_MINMAX to [0.01, 1])
+		inline void from_counts(const int * counts, bool normalization)
+		{
+			float scale = 1, shift = 0;
+			if (normalization){
+				minmax_scale(counts, N, scale, shift);
+			}
+			for (int b = 0; b < N; b++){
+				bins[b] = normalization ? (float)counts[b]*scale + shift : (float)counts[b];
+			}
+		}
+
+		//Bhattacharyya distance to the histogram of N bins, computed as compareHist(..., CV_COMP_BHATTACHARYYA) does
+		inline double bhattacharyya(const float * other) const
+		{
+			double s1 = 0, s2 = 0, coefficient = 0;
+			for (int b = 0; b < N; b++){
+				double a = other[b], c = bins[b];
+				s1 += a;
+				s2 += c;
+				coefficient += std::sqrt(a*c);
+			}
+			s1 *= s2;
+			s1 = fabs(s1) > FLT_EPSILON ? 1./std::sqrt(s1) : 1.;
+			return std::sqrt(std::max(1. - coefficient*s1, 0.));
+		}
+
+		// histogram values
+		std::array<float, N> bins;
+	};
+
+	// scores bins counts of the candidate against the template histogram (bins values) with Bhattacharyya distance
+	typedef double (*HistogramScorer)(const float * gt_bins, const int * counts, bool normalization);
+
+	// scoring loop instantiated for N bins
+	template <int N>
+	double score_histogram(const float * gt_bins, const int * counts, bool normalization)
+	{
+		Histogram<N> hist;
+		hist.from_counts(counts, normalization);
+		return hist.bhattacharyya(gt_bins);
+	}
+
+	// returns the scoring loop instantiated for the bins count (3, 8, 9, 10, 16 and 32),
+	// or 0 if there is none (histograms have to be scored through Mat and compareHist then)
+	HistogramScorer find_histogram_scorer(int bins);
+
+	//class
+	// scores all candidates of the frame at once: candidates values are kept in structure of arrays
+	// (values of one bin of all candidates are contiguous), so every bin is processed for 8 candidates per instruction
+	class BatchBhattacharyya{
+	//Public functions
+	public:
+		//constructor function
+		BatchBhattacharyya(void);
+
+		//precomputes sqrt(gt_hist/sum(gt_hist)) of the template histogram (done once per track)
+		void set_template(const Mat &gt_hist);
+
+		//scores bins counts of candidates (bins_param values per candidate), returns distances (scores)
+		const vector<float> & score(const int * counts, int amount, bool normalization);
+
+		// amount of bins in histogram
+		int bins_param;
+		// square roots of the template histogram divided by its sum
+		vector<float> gt_sqrt;
+		// candidates histograms, bins_param rows of stride values (candidates padded to the vector size)
+		vector<float> candidates_values;
+		// row length of candidates_values
+		int stride;
+		// sums of candidates histograms
+		vector<float> sums;
+		// Bhattacharyya coefficients of candidates (before dividing by sqrt of candidate sum)
+		vector<float> coefficients;
+		// Bhattacharyya distances of candidates to the template (reused every frame)
+		vector<float> scores;
+	};
+
+	//class
+	// Hellinger embedding: Bhattacharyya coefficient is the dot product of sqrt(h/sum(h)) vectors, so all candidates
+	// embedded as rows of one matrix are scored with a single matrix-vector product (gemm)
+	class HellingerEmbedding{
+	//Public functions
+	public:
+		//constructor function
+		HellingerEmbedding(void);
+
+		//embeds the template histogram (done once per track)
+		void set_template(const Mat &gt_hist);
+
+		//scores bins counts of candidates (bins_param values per candidate), returns distances (scores)
+		const vector<float> & score(const int * counts, int amount, bool normalization);
+
+		// amount of bins in histogram
+		int bins_param;
+		// embedded template histogram, bins_param x 1 (CV_32F)
+		Mat gt_embedded;
+		// embedded candidates histograms, amount x bins_param (CV_32F, reused every frame)
+		Mat candidates_embedded;
+		// Bhattacharyya coefficients of candidates, amount x 1 (CV_32F)
+		Mat coefficients;
+		// Bhattacharyya distances of candidates to the template (reused every frame)
+		vector<float> scores;
+	};
+
+	//class
+	// integer path of Bhattacharyya scoring: candidates stay integer counts (ushort when the box area fits),
+	// square roots are taken from a lookup table indexed by count and the coefficient is accumulated in fixed point
+	class IntegerBhattacharyya{
+	//Public functions
+	public:
+		//constructor function
+		IntegerBhattacharyya(void);
+
+		//precomputes sqrt(gt_hist/sum(gt_hist)) of the template histogram in fixed point (done once per track)
+		void set_template(const Mat &gt_hist);
+
+		//builds the square root lookup table for candidates of the area (done again only if the area changes)
+		void prepare(int area, bool normalization);
+
+		//scores bins counts of candidates of the area (bins_param values per candidate), returns distances (scores)
+		//(instantiated for int and ushort counts)
+		template <typename T>
+		const vector<float> & score(const T * counts, int amount, int area, bool normalization);
+
+		// amount of bins in histogram
+		int bins_param;
+		// square roots of the template histogram divided by its sum, 16 fractional bits
+		vector<uint32_t> gt_fixed;
+		// square roots of integers up to the largest index for lut_area, 16 fractional bits
+		vector<uint32_t> sqrt_lut;
+		// candidate area, for which sqrt_lut was built
+		int lut_area;
+		// tells if sqrt_lut was built for normalized histograms
+		bool lut_normalization;
+		// Bhattacharyya distances of candidates to the template (reused every frame)
+		vector<float> scores;
+	};
+
+	//class
+	// Bhattacharyya distance with early termination: bins are summed in order and the candidate is abandoned
+	// as soon as the coefficient cannot reach the one of the best distance so far (the remaining bins are bounded
+	// by Cauchy-Schwarz: sum of sqrt(a*c) <= sqrt(sum of a * sum of c))
+	class BoundedBhattacharyya{
+	//Public functions
+	public:
+		//constructor function
+		BoundedBhattacharyya(void);
+
+		//keeps the template histogram, its sum and sums of its remaining bins (done once per track)
+		void set_template(const Mat &gt_hist);
+
+		//distance of the histogram (bins_param values), or DBL_MAX if it is larger than best
+		double distance(const float * bins, double best);
+
+		//distance of bins counts, normalized like calculate_histogram does, or DBL_MAX if it is larger than best
+		double distance_of_counts(const int * counts, bool normalization, double best);
+
+		// amount of bins in histogram
+		int bins_param;
+		// template histogram values
+		vector<float> gt_bins;
+		// sums of template bins b .. bins_param - 1, bins_param + 1 values
+		vector<double> gt_remaining;
+		// histogram of the candidate built from counts (reused by every candidate)
+		vector<float> candidate_bins;
+		// scored candidates (all frames)
+		long long candidates;
+		// candidates abandoned before their last bin (all frames)
+		long long abandoned;
+		// bins of all scored candidates (all frames)
+		long long bins;
+		// bins not summed thanks to abandoning (all frames)
+		long long skipped_bins;
+	};
+
+	//class
+	class IntegralHistogram{
+	//Public functions
+	public:
+		//constructor function
+		IntegralHistogram(void);
+
+		//builds integral histogram of the quantized frame over the region
+		void build(const BinPlane &bins_plane, Rect search_region);
+
+		//tells if the rectangle lies inside the region of integral histogram
+		bool covers(Rect rectangle) const;
+
+		//writes bins counts of the rectangle to out (bins_param values)
+		void query(Rect rectangle, int * out) const;
+
+		// region of the frame, over which integral histogram was built
+		Rect region;
+		// amount of bins in histogram
+		int bins_param;
+		// cumulative counts, (region.height+1) x (region.width+1) x bins_param values
+		vector<int> table;
+	};
+
+	//class
+	// likelihood map: every bin gets the weight log(p_object/p_background) learned from the first frame, so the score
+	// of a candidate is the mean weight of its pixels, one rectangle sum over a single integral image of weights
+	// (4 lookups per candidate, regardless of bins and candidate size)
+	class LikelihoodMap{
+	//Public functions
+	public:
+		//constructor function
+		LikelihoodMap(void);
+
+		//computes bins weights from counts of the object and of its background (done once per track)
+		void set_template(const int * object_counts, const int * background_counts, int bins);
+
+		//builds integral image of weights of the quantized frame over the region
+		void build(const BinPlane &bins_plane, Rect search_region);
+
+		//distance of the rectangle inside the region: max_weight minus mean weight of its pixels (never negative)
+		inline double distance(Rect rectangle) const
+		{
+			int row_len = region.width + 1;
+			int x0 = rectangle.x - region.x, x1 = x0 + rectangle.width;
+			const double * top = &table[(size_t)(rectangle.y - region.y)*row_len];
+			const double * bottom = top + (size_t)rectangle.height*row_len;
+			double sum = bottom[x1] - bottom[x0] - top[x1] + top[x0];
+			return max_weight - sum/std::max(rectangle.area(), 1);
+		}
+
+		//scores all candidates from the integral image of the frame (extended if they lie out of it), returns distances
+		const vector<float> & score(const BinPlane &bins_plane, const vector<Rect> &candidates);
+
+		// amount of bins in histogram
+		int bins_param;
+		// log-ratio weight of every bin, bins_param + 1 values (values out of range weigh 0)
+		vector<double> weights;
+		// largest weight (distances are taken from it, so they stay positive for normalized fusion)
+		double max_weight;
+		// region of the frame, over which the integral image was built
+		Rect region;
+		// cumulative weights, (region.height+1) x (region.width+1) values
+		vector<double> table;
+		// distances of candidates to the template (reused every frame)
+		vector<float> scores;
+	};
+}
+
+#endif
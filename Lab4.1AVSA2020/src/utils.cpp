@@ -117,3 +117,83 @@ std::vector<float> estimateTrackingPerformance(std::vector<cv::Rect> Bbox_GT, st
 
 	return score;
 }
+
+/**
+ * Division tables of the 8-bit BGR->HSV conversion of OpenCV (fixed point with 12 bits),
+ * so H and S planes computed here are identical to the ones of cvtColor(..., COLOR_BGR2HSV).
+ */
+struct HSVDivisionTables
+{
+	int sdiv[256];	//255/v
+	int hdiv[256];	//180/(6*diff)
+
+	HSVDivisionTables()
+	{
+		sdiv[0] = hdiv[0] = 0;
+		for(int i=1;i<256;i++)
+		{
+			sdiv[i] = saturate_cast<int>((255 << 12)/(1.*i));
+			hdiv[i] = saturate_cast<int>((180 << 12)/(6.*i));
+		}
+	}
+};
+
+/**
+ * Extracts the channel of interest of the BGR frame in a single pass. Only the requested plane
+ * is computed (H or S of HSV, or strided copy of B, G or R), without converting the whole frame
+ * to 3-channel HSV image and splitting it into 3 planes.
+ *
+ * @param frame: BGR frame (8-bit, 3 channels)
+ * @param channel_id: the id of channel of interest
+ *				 0 - gray
+ *				 1 - H from HSV
+ *				 2 - S from HSV
+ *				 3 - B from BGR
+ *				 4 - G from BGR
+ *				 5 - R from BGR
+ * @param channel_frame: output plane (8-bit, 1 channel), written in place if it already has the size of frame
+ *                       (e.g. a region of a bigger plane)
+ */
+void extractChannelOfInterest(const cv::Mat &frame, int channel_id, cv::Mat &channel_frame)
+{
+	static const HSVDivisionTables tables;
+
+	switch(channel_id)
+	{
+	case 0:
+		cvtColor(frame, channel_frame, cv::COLOR_BGR2GRAY);
+		return;
+	case 3:
+	case 4:
+	case 5:
+		extractChannel(frame, channel_frame, channel_id - 3);
+		return;
+	}
+
+	channel_frame.create(frame.size(), CV_8U);
+	for(int y=0;y<frame.rows;y++)
+	{
+		const uchar* src = frame.ptr<uchar>(y);
+		uchar* dst = channel_frame.ptr<uchar>(y);
+		for(int x=0;x<frame.cols;x++, src+=3)
+		{
+			int b = src[0], g = src[1], r = src[2];
+			int v = std::max(b, std::max(g, r));
+			int diff = v - std::min(b, std::min(g, r));
+
+			if(channel_id == 2)
+			{
+				//S = (v - min)/v
+				dst[x] = (uchar)((diff*tables.sdiv[v] + (1 << 11)) >> 12);
+				continue;
+			}
+			//H depends on which of the channels is the maximum one
+			int vr = v == r ? -1 : 0;
+			int vg = v == g ? -1 : 0;
+			int h = (vr & (g - b)) + (~vr & ((vg & (b - r + 2*diff)) + ((~vg) & (r - g + 4*diff))));
+			h = (h*tables.hdiv[diff] + (1 << 11)) >> 12;
+			h += h < 0 ? 180 : 0;
+			dst[x] = saturate_cast<uchar>(h);
+		}
+	}
+}
@@ -8,6 +8,7 @@
  */
 
 #include "ColorBasedTracker.hpp"
+#include "utils.hpp"
 
 #include <opencv2/opencv.hpp>
 
@@ -44,19 +45,24 @@ using namespace tracker;
  *
  * \normal tells, if histograms should be normalized
  *
+ * \histogram_mode the way candidates histograms are computed
+ *				 0 - calcHist for every candidate (reference)
+ *				 1 - integral histogram built once per frame over the search region
+ *				 2 - sliding window scan along the candidates grid rows
+ *				 3 - SIMD counting kernel for every candidate
+ *
  * \return void (it's a starter function).
  *
  */
-ColorBasedTracker::ColorBasedTracker(Mat frame, Rect ground_truth, int bins, int cand, int pix_stride, int channel_id, bool normal)
+ColorBasedTracker::ColorBasedTracker(Mat frame, Rect ground_truth, int bins, int cand, int pix_stride, int channel_id, bool normal, int histogram_mode)
 {
 	normalization = normal;
+	hist_mode = histogram_mode;
 	bins_param = bins;
 	cand_param = cand;
+	cand_param_max = cand;
 	p_stride = pix_stride;
 	channel = channel_id;
-	//extracts channel of interest from the frame
-	convert_RGB_to_channel(frame);
-
 	// set up values range for the histogram
 	// if we are looking at h in hsv, set 180, else 256
 
@@ -67,13 +73,47 @@ ColorBasedTracker::ColorBasedTracker(Mat frame, Rect ground_truth, int bins, int
 		ranges[1] = 256;
 	}
 	const float * range[] = {ranges};
+	// lookup table value -> bin for the quantized frame
+	actual_bins.configure(bins_param, ranges);
+	// fixed size histograms scoring, used when counts of candidates are available
+	histogram_scorer = hist_mode != 0 ? find_histogram_scorer(bins_param) : 0;
+	score_mode = 0;
+	search_strategy = 0;
+	kalman_search = false;
+	// constant-velocity model of the box position
+	motion.configure(MEASUREMENT_SIZE, CONTROL_PARAMS, p_stride);
+	shift_mode = 0;
+	shift_criteria = TermCriteria(TermCriteria::COUNT | TermCriteria::EPS, 10, 1);
+	short_counts = false;
+	early_termination = false;
+
+	//saving last prediction for future frame tracking (search region is placed around it)
+	last_prediction = ground_truth;
+
+	//extracts channel of interest from the frame
+	convert_RGB_to_channel(frame);
 
 
 	//calculating histogram
 	gt_hist = calculate_histogram(ground_truth,range);
-
-	//saving last prediction for future frame tracking
-	last_prediction = ground_truth;
+	// templates for batched scoring
+	batch_scorer.set_template(gt_hist);
+	hellinger_scorer.set_template(gt_hist);
+	integer_scorer.set_template(gt_hist);
+	// bins weights of the likelihood map: the object against the rest of the search region around it
+	if (hist_mode != 0){
+		const int * counts = count_candidate(ground_truth);
+		vector<int> object_counts(counts, counts + bins_param);
+		counts = count_candidate(search_region);
+		vector<int> background_counts(counts, counts + bins_param);
+		for (int b = 0; b < bins_param; b++){
+			background_counts[b] -= object_counts[b];
+		}
+		likelihood_map.set_template(object_counts.data(), background_counts.data(), bins_param);
+	}
+	bounded_scorer.set_template(gt_hist);
+	// likelihood of bins for the back-projection (the most object-like bin gets 255)
+	normalize( gt_hist, backproject_hist, 0, 255, NORM_MINMAX, -1, Mat() );
 }
 
 // destructor
@@ -95,8 +135,18 @@ ColorBasedTracker::~ColorBasedTracker(void)
  *
  *	The function returns the vector of candidates (sized cand_param x cand_param),
  *	where there is always included prediction from previous frame.
+ *	With pyramid.levels > 0 the candidates come from the coarse-to-fine search (pyramid_candidates).
+ *	Otherwise with search_strategy 1, 2 and 3 the only candidate is the winner of the pattern search (pattern_candidates).
  */
 vector<Rect>  ColorBasedTracker::generate_candidates(){
+	// coarse-to-fine search instead of the full grid
+	if (pyramid.levels > 0){
+		return pyramid_candidates();
+	}
+	// block-matching pattern search instead of the full grid
+	if (search_strategy != 0){
+		return pattern_candidates();
+	}
 	vector<Rect> candidates;
 	// dimensions of previous frame result-rectangle
 	float height = last_prediction.height;
@@ -129,47 +179,243 @@ vector<Rect>  ColorBasedTracker::generate_candidates(){
 	}
 
 	//Deleting candidates out of frame bounds
-	int right_x_limit = actual_frame.cols - width;
-	int down_y_limit = actual_frame.rows - height;
+	discard_out_of_frame(candidates);
+	//return vector of candidates
+	return candidates;
+}
+
+/**
+ * Function discard_out_of_frame deletes candidates out of frame bounds (shared by the grid and the pyramid search)
+ *
+ * \candidates vector of candidates
+ */
+void ColorBasedTracker::discard_out_of_frame(vector<Rect> &candidates)
+{
+	Rect origins = candidate_origins(actual_frame.size());
 	for (auto iter = candidates.begin() ; iter != candidates.end(); ) {
-	  if (iter->x<width || iter->x>right_x_limit ||
-				(iter->y)<height || (iter->y)>down_y_limit) {
+	  if (!origins.contains(iter->tl())) {
 		  iter = candidates.erase(iter);
 	  } else {
 	    ++iter;
 	  }
 	}
-	//return vector of candidates
+}
+
+/**
+ * Function candidate_origins returns the rectangle of top left corners of candidates kept inside the frame: the box
+ * stays at least its size away from the left and top frame borders and fits in at the right and bottom ones.
+ * Both discard_out_of_frame and the clamp of the Kalman prediction use these limits.
+ *
+ * \frame_size size of the actual frame
+ */
+Rect ColorBasedTracker::candidate_origins(Size frame_size)
+{
+	int width = last_prediction.width;
+	int height = last_prediction.height;
+	return Rect(width, height, frame_size.width - 2*width + 1, frame_size.height - 2*height + 1);
+}
+
+/**
+ * Function configure_pyramid sets up the coarse-to-fine search: candidates are scored on the search region
+ * downsampled levels times (sparse grid, calcHist of the coarse box) and only the full resolution neighbourhoods
+ * of the top_k best of them are returned by generate_candidates. The coarse template is taken from the frame
+ * given to the constructor, so it has to be called before the first tracking step.
+ * Levels are reduced if the coarse box would be smaller than 8 pixels.
+ *
+ * \levels amount of pyramid levels (0 - the whole candidates grid is scored)
+ * \top_k amount of best coarse candidates refined on the full resolution
+ */
+void ColorBasedTracker::configure_pyramid(int levels, int top_k)
+{
+	pyramid.configure(levels, top_k, last_prediction.size(), 8);
+	if (pyramid.levels == 0){
+		return;
+	}
+	pyramid.downsample(actual_frame, search_region, coarse_frame);
+	coarse_gt_hist = coarse_histogram(pyramid.coarse_rect(last_prediction)).clone();
+}
+
+/**
+ * Function pyramid_candidates scores coarse candidates (Bhattacharyya distance of coarse histograms
+ * to coarse_gt_hist) and returns full resolution candidates around the best top_k of them
+ * (the capture range is the same as the one of the candidates grid)
+ */
+vector<Rect>  ColorBasedTracker::pyramid_candidates(void)
+{
+	int reach = p_stride*(cand_param/2);
+	pyramid.downsample(actual_frame, search_region, coarse_frame);
+
+	vector<Rect> coarse_candidates = pyramid.coarse_grid(last_prediction, reach, p_stride);
+	discard_out_of_frame(coarse_candidates);
+	vector<double> scores(coarse_candidates.size(), DBL_MAX);
+	for (size_t i = 0; i < coarse_candidates.size(); i++){
+		Rect rectangle = pyramid.coarse_rect(coarse_candidates[i]);
+		if (pyramid.fits(rectangle, coarse_frame.size())){
+			scores[i] = compareHist( coarse_gt_hist, coarse_histogram(rectangle), CV_COMP_BHATTACHARYYA );
+		}
+	}
+
+	vector<Rect> candidates = pyramid.refine(coarse_candidates, scores, last_prediction, reach, p_stride);
+	discard_out_of_frame(candidates);
 	return candidates;
 }
 
+/**
+ * Function pattern_candidates searches the frame with the block-matching pattern of search_strategy: every step
+ * probes the pattern around the best candidate so far (scored by best_candidate_index, the centre first so it wins
+ * ties), moves to the best probe and contracts, until the pattern cannot improve. Probes lie on the candidates grid
+ * within its capture range. Returns only the winner (so find_best_candidate of the tracking step just confirms it).
+ */
+vector<Rect>  ColorBasedTracker::pattern_candidates(void)
+{
+	pattern.start(search_strategy, last_prediction, p_stride*(cand_param/2), p_stride);
+	while (!pattern.finished()){
+		vector<Rect> probes = pattern.probes();
+		discard_out_of_frame(probes);
+		if (probes.empty()){
+			break;
+		}
+		// probes are scored without moving last_prediction, nearest the current centre first
+		pattern.update(probes, probes[best_candidate_index(probes, pattern.centre.tl())]);
+	}
+	return vector<Rect>(1, pattern.centre);
+}
+
+/**
+ * Function shift_candidates builds the back-projection of gt_hist over the search region (one likelihood image
+ * per frame, instead of histograms of candidates) and moves last_prediction to the mode of the likelihood with
+ * meanShift (shift_mode 1) or CamShift (shift_mode 2, the box size adapts to the spread of the likelihood).
+ * The window cannot leave the search region, so it moves at most (cand_param/2)*p_stride pixels per frame, like
+ * the candidates grid. Returns only the converged window, which execute_tracking_step takes as the result (no scoring).
+ */
+vector<Rect>  ColorBasedTracker::shift_candidates(void)
+{
+	const float * range[] = {ranges};
+	Mat region_channel = actual_frame(search_region);
+	calcBackProject( &region_channel, 1, 0, backproject_hist, backprojection, range, 1, true );
+
+	// window in the coordinates of the search region
+	Rect window = (last_prediction - search_region.tl()) & Rect(Point(0, 0), search_region.size());
+	if (window.area() == 0){
+		return vector<Rect>(1, last_prediction);
+	}
+	if (shift_mode == 2){
+		CamShift(backprojection, window, shift_criteria);
+	} else {
+		meanShift(backprojection, window, shift_criteria);
+	}
+	// CamShift may collapse the window where there is no likelihood, the prediction is kept then
+	if (window.area() == 0){
+		return vector<Rect>(1, last_prediction);
+	}
+	return vector<Rect>(1, window + search_region.tl());
+}
+
+/**
+ * Function coarse_histogram calculates histogram of the rectangle of the coarse level (calcHist, normalized
+ * like calculate_histogram does)
+ *
+ * \rectangle rectangle in coarse level coordinates
+ */
+Mat ColorBasedTracker::coarse_histogram(Rect rectangle)
+{
+	Mat hist;
+	const float * range[] = {ranges};
+	Mat img_to_compute = coarse_frame(rectangle);
+	calcHist( &img_to_compute, 1, 0, Mat(), hist, 1, &bins_param, range,  true, false);
+	if (normalization){
+		normalize( hist, hist, 0.01, 1, NORM_MINMAX, -1, Mat() );
+	}
+	return hist;
+}
+
 /**
  * Function find_best_candidate calculates histograms, scores them all with Bhattacharyya distance
  * and selects best candidate, taking rectangle that has minimal Bhattacharyya distance (to ground truth
  * histogram gt_hist obtained from first frame)
+ * In hist_mode 1 candidates are queried from the integral histogram built once per frame over the search region
+ * (convert_RGB_to_channel, also for every step of the pattern search), so every candidate histogram takes bins_param lookups regardless of candidate size.
+ * In hist_mode 2 all candidates histograms are computed at once, sliding one running histogram along the grid rows.
+ * If the scoring loop is instantiated for bins_param (fixed size Histogram), counts of candidates are scored
+ * without any allocation, otherwise histograms Mats are scored with compareHist.
+ * In score_mode 1, 2 and 3 counts of all candidates are scored at once (by the batched scorer, the Hellinger embedding
+ * or the integer scorer with square root lookup table).
+ * In score_mode 4 candidates are not counted at all: each of them is one rectangle sum over the integral image
+ * of bins log-ratio weights (likelihood map).
+ * With early_termination (candidates scored one at a time) candidates nearest last_prediction (the anchor) are scored first
+ * and the rest are abandoned as soon as their distance cannot be lower than the best one so far.
  *
  *  \candidates vector of candidates
  *  \return the candidate rectangle that will be object's final prediction for tracked frame
  */
 Rect ColorBasedTracker::find_best_candidate(vector<Rect> candidates){
+	// returning the best candidate for actual frame tracking
+	last_prediction = candidates[best_candidate_index(candidates, last_prediction.tl())];
+	return last_prediction;
+}
+
+/**
+ * Function best_candidate_index scores candidates the way find_best_candidate describes and returns the index
+ * of the best one, without moving last_prediction
+ *
+ *  \candidates vector of candidates
+ *  \anchor point, nearest which candidates are scored first (early_termination)
+ */
+int ColorBasedTracker::best_candidate_index(const vector<Rect> &candidates, Point anchor){
 	vector<double> hist_comp_scores;
 	Mat candidate_hist;
+	double distance;
 
 	// value's range parameter for histogram
 	const float * range[] = {ranges};
 
+	// counts of all candidates (sliding window scan over the candidates grid in hist_mode 2)
+	if (score_mode != 4 && (hist_mode == 2 || (hist_mode != 0 && score_mode != 0))){
+		count_all_candidates(candidates);
+	}
+	// batched scoring of all candidates at once
+	if (hist_mode != 0 && score_mode != 0){
+		const vector<float> & scores = score_all_candidates(candidates);
+		int minElementIndex = min_element(scores.begin(),scores.end()) - scores.begin();
+		return minElementIndex;
+	}
+
+	// promising candidates first, so that the best distance (the bound of abandoning) drops early
+	vector<int> order = scoring_order(candidates, early_termination, anchor);
+	double best_distance = DBL_MAX;
+
 	//iterating through all candidates
-	for (auto it = begin (candidates); it != end (candidates); ++it) {
-		// calculating histogram of candidate
-		candidate_hist = calculate_histogram(*it,range);
-		// computing Bhattacharyya distance
-		hist_comp_scores.push_back(compareHist( gt_hist, candidate_hist, CV_COMP_BHATTACHARYYA ));
+	hist_comp_scores.assign(candidates.size(), DBL_MAX);
+	for (size_t i = 0; i < order.size(); i++) {
+		int index = order[i];
+		if (histogram_scorer != 0){
+			// fixed size histogram of candidate, scored without allocations
+			const int * counts = hist_mode == 2 ? &candidates_counts[index*bins_param] : count_candidate(candidates[index]);
+			if (early_termination){
+				distance = bounded_scorer.distance_of_counts(counts, normalization, best_distance);
+			} else {
+				distance = histogram_scorer(gt_hist.ptr<float>(), counts, normalization);
+			}
+		} else {
+			// calculating histogram of candidate
+			if (hist_mode == 2){
+				counts_to_histogram(&candidates_counts[index*bins_param], bins_param, normalization, candidate_hist);
+			} else {
+				candidate_hist = calculate_histogram(candidates[index],range);
+			}
+			// computing Bhattacharyya distance
+			if (early_termination){
+				distance = bounded_scorer.distance(candidate_hist.ptr<float>(), best_distance);
+			} else {
+				distance = compareHist( gt_hist, candidate_hist, CV_COMP_BHATTACHARYYA );
+			}
+		}
+		hist_comp_scores[index] = distance;
+		best_distance = std::min(best_distance, distance);
 	}
 	// finding index of candidate, which has the smallest distance from the ground through histogram gt_hist
 	int minElementIndex = min_element(hist_comp_scores.begin(),hist_comp_scores.end()) - hist_comp_scores.begin();
-	// returning the best candidate for actual frame tracking
-	last_prediction = candidates[minElementIndex];
-	return last_prediction;
+	return minElementIndex;
 }
 
 
@@ -177,20 +423,53 @@ Rect ColorBasedTracker::find_best_candidate(vector<Rect> candidates){
 /**
  * Function execute_tracking_step conducts tracker step for every frame. Firstly it extracts channel of interest from the frame,
  * later it generates candidates and finally scores them and chooses the best rectangle-candidate, which is returned as the
- * result of tracking
+ * result of tracking (candidates are kept in step_candidates).
+ * With kalman_search the search is moved to the position predicted by the Kalman filter before the conversion
+ * (predict_search_window).
+ * In shift_mode 1 and 2 no candidates are generated nor scored, the window converged by meanShift or CamShift
+ * (shift_candidates) is the result.
  */
 Rect ColorBasedTracker::execute_tracking_step(Mat frame)
 {
+	// search centred on the position predicted by the constant-velocity model, the grid covers its uncertainty
+	if (kalman_search){
+		predict_search_window(frame.size());
+	}
 	//extracts channel of interest from the frame
 	convert_RGB_to_channel(frame);
+	// the window converged by meanShift or CamShift is the result, there is nothing to score
+	if (shift_mode != 0){
+		step_candidates = shift_candidates();
+		last_prediction = step_candidates[0];
+		return last_prediction;
+	}
 	//generates candidates
-	vector<Rect> list_candidates = generate_candidates();
+	step_candidates = generate_candidates();
 	//scores candidates and return the best one
-	return find_best_candidate(list_candidates);
+	return find_best_candidate(step_candidates);
+}
+
+/**
+ * Function predict_search_window corrects the Kalman filter with the previous result, moves last_prediction
+ * to the predicted position (clamped to candidate_origins) and sets cand_param from the innovation covariance
+ * (at most cand_param_max), so the search region and candidates grid are placed around the prediction
+ *
+ * \frame_size size of the actual frame
+ */
+void ColorBasedTracker::predict_search_window(Size frame_size)
+{
+	Point predicted = motion.step(last_prediction.tl());
+	// the box is kept where discard_out_of_frame keeps candidates
+	Rect origins = candidate_origins(frame_size);
+	predicted.x = std::min(std::max(predicted.x, origins.x), origins.x + origins.width - 1);
+	predicted.y = std::min(std::max(predicted.y, origins.y), origins.y + origins.height - 1);
+	last_prediction = Rect(predicted, last_prediction.size());
+	cand_param = motion.grid_side(p_stride, cand_param_max);
 }
 
 /**
  * Function calculates histograms for given candidate rectangle
+ * (in hist_mode 1, 2 and 3 from bins counts of count_candidate)
  *
  * \rectangle the candidate for which histogram will be computed
  * \range the range of histogram values
@@ -201,6 +480,15 @@ Mat ColorBasedTracker::calculate_histogram(Rect rectangle, const float * range[]
 {
 	// matrix which will keep histogram
 	Mat hist;
+
+	// rectangles out of the candidates grid (e.g. ground truth) need their own conversion
+	convert_outside_region(rectangle);
+
+	if (hist_mode != 0){
+		counts_to_histogram(count_candidate(rectangle), bins_param, normalization, hist);
+		return hist;
+	}
+
 	Mat img_to_compute = actual_frame(rectangle);
 	// calculating histogram of candidate
 	calcHist( &img_to_compute, 1, 0, Mat(), hist, 1, &bins_param, range,  true, false);
@@ -212,8 +500,98 @@ Mat ColorBasedTracker::calculate_histogram(Rect rectangle, const float * range[]
 	return hist;
 }
 
+/**
+ * Function count_all_candidates counts bins of all candidates to candidates_counts, bins_param values per candidate
+ * (in hist_mode 2 with one running histogram sliding along the grid rows, otherwise with count_candidate).
+ * In score_mode 3 counts go to candidates_counts_short instead, if the candidate area fits to ushort.
+ *
+ * \candidates vector of candidates
+ */
+void ColorBasedTracker::count_all_candidates(const vector<Rect> &candidates)
+{
+	short_counts = score_mode == 3 && !candidates.empty() && candidates[0].area() <= USHRT_MAX;
+	if (hist_mode == 2){
+		if (short_counts){
+			sliding_window_histograms(actual_bins, candidates, candidates_counts_short);
+		} else {
+			sliding_window_histograms(actual_bins, candidates, candidates_counts);
+		}
+		return;
+	}
+	if (short_counts){
+		candidates_counts_short.resize(candidates.size()*bins_param);
+	} else {
+		candidates_counts.resize(candidates.size()*bins_param);
+	}
+	for (size_t i = 0; i < candidates.size(); i++){
+		const int * counts = count_candidate(candidates[i]);
+		if (short_counts){
+			copy(counts, counts + bins_param, &candidates_counts_short[i*bins_param]);
+		} else {
+			copy(counts, counts + bins_param, &candidates_counts[i*bins_param]);
+		}
+	}
+}
+
+/**
+ * Function score_all_candidates scores counts of all candidates (gathered by count_all_candidates) at once,
+ * with the scorer selected by score_mode (score_mode 4 scores the likelihood map instead, no counts are needed)
+ *
+ * \candidates vector of candidates
+ *
+ * \return Bhattacharyya distances of candidates to gt_hist (likelihood distances in score_mode 4), in candidates order
+ */
+const vector<float> & ColorBasedTracker::score_all_candidates(const vector<Rect> &candidates)
+{
+	int amount = candidates.size();
+	if (score_mode == 4){
+		return likelihood_map.score(actual_bins, candidates);
+	}
+	if (score_mode == 1){
+		return batch_scorer.score(candidates_counts.data(), amount, normalization);
+	}
+	if (score_mode == 2){
+		return hellinger_scorer.score(candidates_counts.data(), amount, normalization);
+	}
+	int area = candidates.empty() ? 0 : candidates[0].area();
+	if (short_counts){
+		return integer_scorer.score(candidates_counts_short.data(), amount, area, normalization);
+	}
+	return integer_scorer.score(candidates_counts.data(), amount, area, normalization);
+}
+
+/**
+ * Function count_candidate counts bins of the candidate rectangle into the fixed buffer counts_buffer
+ * (taken from the integral histogram in hist_mode 1, if it covers the rectangle,
+ * otherwise in hist_mode 1 and 2 counted from the quantized frame actual_bins;
+ * in hist_mode 3 counted by the SIMD kernel)
+ *
+ * \rectangle the candidate for which bins will be counted
+ *
+ * \return bins counts of the candidate (bins_param + 1 values, the last one gathers values out of range)
+ */
+const int * ColorBasedTracker::count_candidate(Rect rectangle)
+{
+	counts_buffer.assign(bins_param + 1, 0);
+	if (hist_mode == 1 && integral_hist.covers(rectangle)){
+		// integral histogram lookups
+		integral_hist.query(rectangle, counts_buffer.data());
+	} else if (hist_mode == 3){
+		// SIMD counting kernel
+		count_histogram(actual_bins, rectangle, counts_buffer.data());
+	} else {
+		// counting bins indexes of the quantized frame
+		actual_bins.count(rectangle.x, rectangle.x + rectangle.width, rectangle.y, rectangle.height, 1, counts_buffer.data());
+	}
+	return counts_buffer.data();
+}
+
 /**
  * Function convert_RGB_to_channel extracts appropriate channel from the frame, type of channel depends from parameter channel_id
+ * (fused conversion, no intermediate HSV image nor split planes are created)
+ * Only the search region (bounding box of all candidates around last_prediction) is converted, the rest of actual_frame
+ * is left untouched. The frame is not copied: it has to stay undrawn until the next call,
+ * since pixels out of the search region are converted from it on demand.
  * Channel_id - channel mapping
  * 0 - gray
  * 1 - H from HSV
@@ -221,36 +599,90 @@ Mat ColorBasedTracker::calculate_histogram(Rect rectangle, const float * range[]
  * 3 - B from BGR
  * 4 - G from BGR
  * 5 - R from BGR
+ * In hist_mode 1, 2 and 3 it also emits the quantized frame actual_bins (bins indexes taken from precomputed lookup table)
+ * In hist_mode 1 it also builds the integral histogram of the search region (in score_mode 4 the integral image
+ * of the likelihood map instead, in shift_mode 1 and 2 neither of them)
  */
 void ColorBasedTracker::convert_RGB_to_channel(Mat frame)
 {
-	Mat split_frame[3];
-	switch(channel) {
-	   case 0  :
-		   cvtColor(frame, actual_frame, cv::COLOR_BGR2GRAY);
-		   break;
-	   case 1  :
-		   cvtColor(frame, actual_frame, cv::COLOR_BGR2HSV);
-		   split(actual_frame, split_frame);
-		   actual_frame = split_frame[0];
-		   break;
-	   case 2 :
-		   cvtColor(frame, actual_frame, cv::COLOR_BGR2HSV);
-		   split(actual_frame, split_frame);
-		   actual_frame = split_frame[1];
-	   	   break;
-	   case 3:
-		   split(frame, split_frame);
-		   actual_frame = split_frame[0];
-	   	   break;
-	   case 4:
-		   split(frame, split_frame);
-		   actual_frame = split_frame[1];
-	   	   break;
-	   case 5:
-		   split(frame, split_frame);
-		   actual_frame = split_frame[2];
-	   	   break;
+	// header of the caller's frame (no copy), read only by convert_outside_region
+	current_frame = frame;
+	search_region = compute_search_region(frame.size());
+
+	// actual_frame keeps the size of the frame (allocated once), only the region is written
+	actual_frame.create(frame.size(), CV_8U);
+	Mat region_channel = actual_frame(search_region);
+	//computing only the requested plane, in one pass over the region
+	extractChannelOfInterest(frame(search_region), channel, region_channel);
+
+	// quantizing the channel to bins indexes, shared by all candidates histograms
+	if (hist_mode != 0){
+		actual_bins.quantize(actual_frame, search_region);
+	}
+	// integral tables of the search region, built once per frame and only queried by candidates
+	if (hist_mode != 0 && shift_mode == 0){
+		if (score_mode == 4){
+			likelihood_map.build(actual_bins, search_region);
+		} else if (hist_mode == 1){
+			integral_hist.build(actual_bins, search_region);
+		}
+	}
+}
+
+/**
+ * Function scoring_order returns indexes of candidates in the order they are scored: nearest the anchor first
+ * (the object moves little between frames, so these candidates are the likely winners), otherwise as generated
+ *
+ * \candidates vector of candidates
+ * \nearest_first tells, if candidates are sorted by their distance to the anchor
+ * \anchor the predicted position (last_prediction of the tracking step, or the centre of the search pattern)
+ */
+vector<int> ColorBasedTracker::scoring_order(const vector<Rect> &candidates, bool nearest_first, Point anchor)
+{
+	vector<int> order(candidates.size());
+	for (size_t i = 0; i < order.size(); i++){
+		order[i] = (int)i;
 	}
+	if (nearest_first){
+		stable_sort(order.begin(), order.end(), [&candidates, anchor](int a, int b){
+			Point da = candidates[a].tl() - anchor, db = candidates[b].tl() - anchor;
+			return da.dot(da) < db.dot(db);
+		});
+	}
+	return order;
+}
+
+/**
+ * Function compute_search_region returns the bounding box of the candidates grid generated around last_prediction
+ * (generate_candidates shifts the box at most (cand_param/2)*p_stride pixels in every direction), clipped to the frame
+ *
+ * \frame_size size of the actual frame
+ *
+ * \return the part of the frame, which is read by candidates histograms
+ */
+Rect ColorBasedTracker::compute_search_region(Size frame_size)
+{
+	int reach = p_stride*(cand_param/2);
+	Rect region(last_prediction.x - reach, last_prediction.y - reach,
+			last_prediction.width + 2*reach, last_prediction.height + 2*reach);
+	return region & Rect(Point(0, 0), frame_size);
 }
 
+/**
+ * Function convert_outside_region converts the rectangle from the frame given to convert_RGB_to_channel,
+ * if it does not lie inside the search region (e.g. ground truth rectangle used for visualisation)
+ *
+ * \rectangle the rectangle which will be read from actual_frame
+ */
+void ColorBasedTracker::convert_outside_region(Rect rectangle)
+{
+	if ((rectangle & search_region) == rectangle || current_frame.empty()){
+		return;
+	}
+	Rect area = rectangle & Rect(Point(0, 0), current_frame.size());
+	Mat area_channel = actual_frame(area);
+	extractChannelOfInterest(current_frame(area), channel, area_channel);
+	if (hist_mode != 0){
+		actual_bins.quantize(actual_frame, area);
+	}
+}
@@ -0,0 +1,163 @@
+/* Applied Video Sequence Analysis (AVSA)
+ *
+ *	LAB4: SearchEngine
+ *	SearchEngine.hpp
+ *
+ * 	Authors: Sergio Romero & Jan Sieradzki
+ *	VPULab-UAM 2020
+ */
+
+
+#include <opencv2/opencv.hpp>
+#ifndef SearchEngine_HPP_INCLUDE
+#define SearchEngine_HPP_INCLUDE
+
+#include <set>
+
+using namespace cv;
+using namespace std;
+
+namespace tracker {
+
+	//class
+	// coarse-to-fine candidates search: the search region is downsampled by an image pyramid, candidates are scored
+	// on the coarse level on a sparse grid and only the neighbourhoods of the best k of them are scored on the full
+	// resolution grid (the geometry is shared by all trackers, each of them scores coarse candidates on its own)
+	class PyramidSearch{
+	//Public functions
+	public:
+		//constructor function
+		PyramidSearch(void);
+
+		//sets levels and k (levels are reduced, so that the coarse box side is at least min_box_side)
+		void configure(int pyramid_levels, int k, Size box_size, int min_box_side);
+
+		//downsamples the region of the plane levels times (done once per frame and plane)
+		void downsample(const Mat &plane, Rect search_region, Mat &coarse);
+
+		//rectangle of the frame mapped to the coarse level
+		Rect coarse_rect(Rect rectangle) const;
+
+		//tells if the coarse rectangle lies inside the coarse level of the given size
+		bool fits(Rect rectangle, Size coarse_size) const;
+
+		//distance between coarse candidates, a multiple of the grid stride not smaller than the downsampling scale
+		int coarse_step(int stride) const;
+
+		//coarse candidates (frame coordinates) around the prediction, at most reach pixels away
+		vector<Rect> coarse_grid(Rect prediction, int reach, int stride) const;
+
+		//full resolution candidates around the k best coarse candidates (and the prediction), row by row
+		vector<Rect> refine(const vector<Rect> &coarse_candidates, const vector<double> &scores, Rect prediction,
+				int reach, int stride);
+
+		//average amount of candidates scored per frame (both levels)
+		double evaluations_per_frame(void) const;
+
+		// amount of pyramid levels (0 - no coarse level, candidates grid is scored as is)
+		int levels;
+		// amount of best coarse candidates, around which the full resolution grid is scored
+		int top_k;
+		// downsampling factor of the coarse level (2^levels)
+		int scale;
+		// part of the frame, which was downsampled last
+		Rect region;
+		// searched frames
+		long long frames;
+		// candidates scored on the coarse level (all frames)
+		long long coarse_evaluations;
+		// candidates returned for the full resolution scoring (all frames)
+		long long fine_evaluations;
+	};
+
+	//class
+	// block-matching search patterns of video coders: the pattern is probed around the centre, the centre moves
+	// to the best probe and the pattern contracts, until it cannot improve (the tracker scores every step's probes,
+	// the class keeps the geometry and counts evaluated candidates)
+	class PatternSearch{
+	//Public functions
+	public:
+		//constructor function
+		PatternSearch(void);
+
+		//starts the search of the frame around the prediction
+		void start(int search_strategy, Rect prediction, int reach_pixels, int stride);
+
+		//tells if the search of the frame has ended
+		bool finished(void) const;
+
+		//candidates of the current step: the centre first, then points of the pattern not probed yet in this frame
+		vector<Rect> probes(void);
+
+		//moves the centre to the best probe and contracts the pattern (scored are the probes, which were evaluated)
+		void update(const vector<Rect> &scored, Rect best);
+
+		//average amount of candidates evaluated per frame
+		double evaluations_per_frame(void) const;
+
+		//the way the pattern is probed and contracted
+		// 1 - three-step search (8 neighbours at the step, the step halves every iteration)
+		// 2 - diamond search (large diamond until the centre wins, then small diamond once)
+		// 3 - hexagon-based search (large hexagon until the centre wins, then small diamond once)
+		int strategy;
+		// centre of the pattern (the best candidate so far)
+		Rect centre;
+		// rectangle predicted in the previous frame (probes are at most reach pixels away from it)
+		Rect origin;
+		// largest shift of probes from the origin
+		int reach;
+		// pixel distance between candidates of the grid (unit of diamond and hexagon patterns)
+		int unit;
+		// distance of three-step search probes from the centre
+		int step;
+		// tells if the last, small pattern is probed
+		bool small_pattern;
+		// tells if the search of the frame has ended
+		bool done;
+		// iterations of the search of the frame
+		int iterations;
+		// origins (y, x) already probed in the frame
+		set<pair<int, int> > visited;
+		// searched frames
+		long long frames;
+		// evaluated candidates (all frames)
+		long long evaluations;
+	};
+
+	//class
+	// constant-velocity Kalman filter of the box position (top left corner): the search is centred on the predicted
+	// position and its extent is taken from the innovation covariance (the uncertainty of the next measurement)
+	class MotionPredictor{
+	//Public functions
+	public:
+		//constructor function
+		MotionPredictor(void);
+
+		//sets up the filter, state (x, y, vx, vy) and measurement (x, y), measurement noise from the grid stride
+		void configure(int measurement_size, int control_params, int stride);
+
+		//corrects the filter with the measured position (initializes it at the first call), returns the predicted one
+		Point step(Point measured);
+
+		//side of the candidates grid covering the gate of the predicted position (odd, at most max_side)
+		int grid_side(int stride, int max_side);
+
+		//average side of the candidates grid per frame
+		double average_grid_side(void) const;
+
+		// constant-velocity filter
+		KalmanFilter filter;
+		// tells if the state was initialized by the first measurement
+		bool initialized;
+		// gate of the search, in standard deviations of the innovation
+		double gate;
+		// variance of the velocity change between frames (pixels^2)
+		double process_noise;
+		// predicted frames
+		long long frames;
+		// sides of candidates grids (all frames)
+		long long sides;
+	};
+}
+
+#endif
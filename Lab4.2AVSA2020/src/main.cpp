@@ -49,12 +49,56 @@ using namespace tracker;
 //ACCORDING TO ALGORITHM IT SHOULD BE ALWAYS TRUE - DONT CHANGE IT!
 #define NORMALIZATION_COL true
 
+//HISTOGRAM_MODE is the way candidates histograms are computed
+//				 0 - calcHist for every candidate (reference)
+//				 1 - integral histogram built once per frame over the search region
+//				 2 - sliding window scan along the candidates grid rows
+//				 3 - SIMD counting kernel for every candidate
+#define HISTOGRAM_MODE 0
+
+//SCORE_MODE is the way candidates histograms are scored (HISTOGRAM_MODE 1, 2 and 3)
+//				 0 - one candidate at a time
+//				 1 - all candidates at once (batched Bhattacharyya)
+//				 2 - all candidates at once (Hellinger embedding, one matrix-vector product)
+//				 3 - all candidates at once (integer counts, square root lookup table)
+//				 4 - all candidates at once (likelihood map: mean log-ratio weight of pixels, one integral image)
+#define SCORE_MODE 0
+
+//EARLY_TERMINATION tells, if candidates are scored nearest the last prediction first and abandoned as soon as
+//their Bhattacharyya distance cannot be lower than the best one so far (SCORE_MODE 0 or HISTOGRAM_MODE 0)
+#define EARLY_TERMINATION false
+
+//PYRAMID_LEVELS is the amount of image pyramid levels of the coarse-to-fine search (0 - the whole candidates grid
+//is scored); candidates are scored on the downsampled search region first and only the neighbourhoods
+//of the PYRAMID_TOP_K best of them are scored on the full resolution grid
+#define PYRAMID_LEVELS 0
+#define PYRAMID_TOP_K 3
+
+//SEARCH_STRATEGY is the way candidates are searched (PYRAMID_LEVELS 0), block-matching patterns probe around
+//the best candidate so far and contract, instead of scoring the whole grid
+//				 0 - the whole candidates grid
+//				 1 - three-step search
+//				 2 - diamond search
+//				 3 - hexagon-based search
+#define SEARCH_STRATEGY 0
+
+//KALMAN_SEARCH tells, if the search is centred on the position predicted by a constant-velocity Kalman filter and
+//the candidates grid is sized from its innovation covariance (CANDIDATE_GRID_SIDE is then the largest side)
+#define KALMAN_SEARCH false
+
+//SHIFT_MODE is the way the object is searched: candidates scored against the template, or the window moved to the mode
+//of the back-projection of the template histogram in the search region (no candidates histograms)
+//				 0 - candidates (grid, pyramid or pattern search)
+//				 1 - meanShift
+//				 2 - CamShift (adapts the box size)
+#define SHIFT_MODE 0
+
 //main function
 int main(int argc, char ** argv)
 {
 	cout<< "Lab4_1_color_tracker" << endl <<
 				" Params: chan " << CHANNEL_TYPE << " cands " << CANDIDATE_GRID_SIDE << " stride " << GRID_PIXEL_STRIDE << " bins " << BINS_NUMBER  <<
-				" normal " << NORMALIZATION_COL << endl;
+				" normal " << NORMALIZATION_COL << " hist_mode " << HISTOGRAM_MODE << " score_mode " << SCORE_MODE << " early_term " << EARLY_TERMINATION << " pyramid " << PYRAMID_LEVELS << " top_k " << PYRAMID_TOP_K << " search " << SEARCH_STRATEGY << " kalman " << KALMAN_SEARCH << " shift " << SHIFT_MODE << endl;
 	//PLEASE CHANGE 'dataset_path' & 'output_path' ACCORDING TO YOUR PROJECT
 	//std::string dataset_path = "/home/janek/avsa/AVSA2020datasets/AVSA_lab4_datasets/datasets/";
 	//std::string output_path = "/home/janek/avsa/AVSA2020results/outvideos/";	//location to save output videos
@@ -140,7 +184,13 @@ int main(int argc, char ** argv)
 		int hist_w = 250, hist_h = 250;
 		int bin_w = cvRound( (double) hist_w/BINS_NUMBER );
 		// initialization of tracking class,
-		ColorBasedTracker tracker(frame,list_bbox_gt[0],BINS_NUMBER,CANDIDATE_GRID_SIDE,GRID_PIXEL_STRIDE,CHANNEL_TYPE, NORMALIZATION_COL);
+		ColorBasedTracker tracker(frame,list_bbox_gt[0],BINS_NUMBER,CANDIDATE_GRID_SIDE,GRID_PIXEL_STRIDE,CHANNEL_TYPE, NORMALIZATION_COL, HISTOGRAM_MODE);
+		tracker.score_mode = SCORE_MODE;
+		tracker.early_termination = EARLY_TERMINATION;
+		tracker.search_strategy = SEARCH_STRATEGY;
+		tracker.kalman_search = KALMAN_SEARCH;
+		tracker.shift_mode = SHIFT_MODE;
+		tracker.configure_pyramid(PYRAMID_LEVELS, PYRAMID_TOP_K);
 		for (;;) {
 			//get frame & check if we achieved the end of the videofile (e.g. frame.data is empty)
 
@@ -158,15 +208,11 @@ int main(int argc, char ** argv)
 			//DO TRACKING
 			//Change the following line with your own code
 
-			//Conducting the tracking step for video's frame - not in usage because we want to get list_candidates for experiment visualisation
-			//list_bbox_est.push_back(tracker.execute_tracking_step(frame));
-
-			//extracts channel of interest from the frame
-			tracker.convert_RGB_to_channel(frame);
-			//generates candidates
-			list_candidates = tracker.generate_candidates();
-			//scores candidates and return the best one
-			list_bbox_est.push_back(tracker.find_best_candidate(list_candidates));
+			//Conducting the tracking step for video's frame (undrawn copy made before the time measurement: the tracker
+			//converts pixels out of its search region from it later, e.g. for the ground truth histogram)
+			list_bbox_est.push_back(tracker.execute_tracking_step(frame_for_crop));
+			//candidates of the step, for experiment visualisation
+			list_candidates = tracker.step_candidates;
 
 			////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -230,6 +276,16 @@ int main(int argc, char ** argv)
 		//print stats about processing time and tracking performance
 		std::cout << "  Average processing time = " << std::accumulate( procTimes.begin(), procTimes.end(), 0.0) / procTimes.size() << " ms/frame" << std::endl;
 		std::cout << "  Average tracking performance = " << std::accumulate( trackPerf.begin(), trackPerf.end(), 0.0) / trackPerf.size() << std::endl;
+		if (PYRAMID_LEVELS > 0)
+			std::cout << "  Pyramid search: candidates scored per frame = " << tracker.pyramid.evaluations_per_frame()
+					<< " (" << tracker.pyramid.coarse_evaluations << " coarse, " << tracker.pyramid.fine_evaluations << " full resolution)" << std::endl;
+		else if (SEARCH_STRATEGY != 0)
+			std::cout << "  Pattern search: candidates evaluated per frame = " << tracker.pattern.evaluations_per_frame() << std::endl;
+		if (KALMAN_SEARCH)
+			std::cout << "  Kalman search: average grid side = " << tracker.motion.average_grid_side() << " (of " << CANDIDATE_GRID_SIDE << ")" << std::endl;
+		if (EARLY_TERMINATION)
+			std::cout << "  Early termination: abandoned candidates = " << tracker.bounded_scorer.abandoned << " of " << tracker.bounded_scorer.candidates
+					<< ", skipped bins = " << tracker.bounded_scorer.skipped_bins << " of " << tracker.bounded_scorer.bins << std::endl;
 
 		//release all resources
 		cap.release();			// close inputvideo
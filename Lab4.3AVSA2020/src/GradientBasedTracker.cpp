@@ -8,6 +8,7 @@
  */
 
 #include "GradientBasedTracker.hpp"
+#include "utils.hpp"
 
 #include <opencv2/opencv.hpp>
 
@@ -43,16 +44,55 @@ using namespace tracker;
  *				 5 - R from BGR
  *
  * \normal tells, if histograms should be normalized
+ *
+ * \hog_computation_mode the way candidates HOG descriptors are computed
+ *				 0 - hog.compute for every candidate (reference)
+ *				 1 - assembled from gradients computed once per frame over the search region
+ *				 2 - assembled from cells of integral orientation histograms built once per frame
+ *
+ * \fast_gradients tells, if gradients of hog_mode 1 and 2 are computed by the vectorised kernel (int16 derivatives,
+ *				 no atan2 nor gamma correction) instead of HOGDescriptor::computeGradient
+ *
+ * \pca_dimensions amount of principal components of HOG blocks of the object (learned from the ground truth box
+ *				 and the candidates around it in the first frame), in which candidates are scored (0 - full descriptors);
+ *				 ignored with normalization or hog_mode 0, where the descriptor would be computed and projected for every
+ *				 candidate, which is slower than its float L2 distance
+ *
+ * \dense tells, if candidates may be scored by distances of their 8 x 8 cells histograms to the template cells, which are
+ *				 computed for all windows of the search region at once by FFT correlation; it is decided once for the track
+ *				 (from the largest grid), used only if that grid is dense enough for it to be cheaper than descriptors
+ *				 (cell features, not HOG L2), and then every frame of the track is scored this way
+ *
  * \return void (it's a starter function).
  *
  */
-GradientBasedTracker::GradientBasedTracker(Mat frame, Rect ground_truth, int bins, int cand, int pix_stride, int channel_id, bool normal)
+GradientBasedTracker::GradientBasedTracker(Mat frame, Rect ground_truth, int bins, int cand, int pix_stride, int channel_id, bool normal, int hog_computation_mode, bool fast_gradients, int pca_dimensions, bool dense)
 {
 	normalization = normal;
 	bins_param = bins;
 	cand_param = cand;
+	cand_param_max = cand;
 	p_stride = pix_stride;
 	channel = channel_id;
+	hog_mode = hog_computation_mode;
+	dense_matching = dense;
+	hog_cache = false;
+	hog_precision = 0;
+	precision_check = false;
+	hog_batch = false;
+	search_strategy = 0;
+	kalman_search = false;
+	// constant-velocity model of the box position
+	motion.configure(MEASUREMENT_SIZE, CONTROL_PARAMS, p_stride);
+	early_termination = false;
+	// block weights of the shared gradient field and of the scratch one (rectangles out of the search region)
+	gradient_field.configure(bins_param);
+	gradient_field.fast_kernel = fast_gradients;
+	outside_field.configure(bins_param);
+	outside_field.fast_kernel = fast_gradients;
+	//saving last prediction for future frame tracking (search region is placed around it)
+	last_prediction = ground_truth;
+
 	//extracts channel of interest from the frame
 	convert_RGB_to_channel(frame);
 
@@ -61,12 +101,37 @@ GradientBasedTracker::GradientBasedTracker(Mat frame, Rect ground_truth, int bin
 
 
 
+	//HOG extractor configured for the box size (fixed per track)
+	hog_extractor.configure(ground_truth.size(), bins_param);
+
 	//calculating histogram
 	gt_hist = calculate_HOG(ground_truth);
+	batch_l2.set_template(gt_hist);
+
+	// PCA subspace of the object blocks, learned from the ground truth box and the candidates around it
+	// (only if blocks of the frame can be projected once and shared, i.e. unnormalized blocks of hog_mode 1 and 2)
+	if (pca_dimensions > 0 && !normalization && hog_mode != 0){
+		vector<Rect> sample_boxes = generate_candidates();
+		int step = std::max(((int)sample_boxes.size() + 399)/400, 1);
+		Mat samples(1, (int)gt_hist.total(), CV_32F);
+		gt_hist.reshape(1, 1).copyTo(samples);
+		for (size_t i = 0; i < sample_boxes.size(); i += step){
+			samples.push_back(compute_HOG(sample_boxes[i]).reshape(1, 1));
+		}
+		hog_pca.learn(samples, pca_dimensions, 4*bins_param, gt_hist);
+	}
 
-
-	//saving last prediction for future frame tracking
-	last_prediction = ground_truth;
+	// template cells for dense matching, DFT sized for the search region around a box far from frame borders
+	if (dense_matching){
+		if (hog_mode == 0){
+			gradient_field.compute(actual_frame, search_region);
+		}
+		int reach = p_stride*(cand_param_max/2) + 1;
+		Size largest_region = ground_truth.size() + Size(2*reach, 2*reach);
+		dense_matcher.set_template(gradient_field, ground_truth, largest_region);
+		// decided once for the track from its largest grid, so all frames are scored by the same distance
+		dense_matching = dense_matcher.pays_off(largest_region, cand_param_max*cand_param_max, (int)gt_hist.total());
+	}
 }
 
 // destructor
@@ -88,8 +153,18 @@ GradientBasedTracker::~GradientBasedTracker(void)
  *
  *	The function returns the vector of candidates (sized cand_param x cand_param),
  *	where there is always included prediction from previous frame.
+ *	With pyramid.levels > 0 the candidates come from the coarse-to-fine search (pyramid_candidates).
+ *	Otherwise with search_strategy 1, 2 and 3 the only candidate is the winner of the pattern search (pattern_candidates).
  */
 vector<Rect>  GradientBasedTracker::generate_candidates(){
+	// coarse-to-fine search instead of the full grid
+	if (pyramid.levels > 0){
+		return pyramid_candidates();
+	}
+	// block-matching pattern search instead of the full grid
+	if (search_strategy != 0){
+		return pattern_candidates();
+	}
 	vector<Rect> candidates;
 	// dimensions of previous frame result-rectangle
 	float height = last_prediction.height;
@@ -121,48 +196,238 @@ vector<Rect>  GradientBasedTracker::generate_candidates(){
 		candidates.push_back(Rect(prev_x-p_stride*counter,prev_y+p_stride*counter,width,height));
 	}
 
+	// origins on the lattice of cells shared by the HOG cache
+	snap_to_cells(candidates);
 	//Deleting candidates out of frame bounds
-	int right_x_limit = actual_frame.cols - width;
-	int down_y_limit = actual_frame.rows - height;
+	discard_out_of_frame(candidates);
+
+	//return vector of candidates
+	return candidates;
+}
+
+/**
+ * Function discard_out_of_frame deletes candidates out of frame bounds (shared by the grid and the pyramid search)
+ *
+ * \candidates vector of candidates
+ */
+void GradientBasedTracker::discard_out_of_frame(vector<Rect> &candidates)
+{
+	Rect origins = candidate_origins(actual_frame.size());
 	for (auto iter = candidates.begin() ; iter != candidates.end(); ) {
-	  if (iter->x<width || iter->x>right_x_limit ||
-				(iter->y)<height || (iter->y)>down_y_limit) {
+	  if (!origins.contains(iter->tl())) {
 		  iter = candidates.erase(iter);
 	  } else {
 		++iter;
 	  }
 	}
+}
 
-	//return vector of candidates
+/**
+ * Function candidate_origins returns the rectangle of top left corners of candidates kept inside the frame: the box
+ * stays at least its size away from the left and top frame borders and fits in at the right and bottom ones.
+ * Both discard_out_of_frame and the clamp of the Kalman prediction use these limits.
+ *
+ * \frame_size size of the actual frame
+ */
+Rect GradientBasedTracker::candidate_origins(Size frame_size)
+{
+	int width = last_prediction.width;
+	int height = last_prediction.height;
+	return Rect(width, height, frame_size.width - 2*width + 1, frame_size.height - 2*height + 1);
+}
+
+/**
+ * Function snap_to_cells moves origins of candidates to the lattice of cell_snap_pitch around last_prediction
+ * (hog_cache in hog_mode 1 and 2), so candidates share cells and blocks of the cache and the scored window is
+ * the candidate itself. Nothing moves if p_stride divides the cell size. The pitch is more than half of p_stride,
+ * so neighbouring candidates stay distinct.
+ *
+ * \candidates vector of candidates
+ */
+void GradientBasedTracker::snap_to_cells(vector<Rect> &candidates)
+{
+	if (!hog_cache || hog_mode == 0){
+		return;
+	}
+	int pitch = cell_snap_pitch(p_stride);
+	for (size_t i = 0; i < candidates.size(); i++){
+		candidates[i] = snap_to_lattice(candidates[i], last_prediction.tl(), pitch);
+	}
+}
+
+/**
+ * Function configure_pyramid sets up the coarse-to-fine search: candidates are scored on the search region
+ * downsampled levels times (sparse grid, HOG descriptor of the coarse box) and only the full resolution
+ * neighbourhoods of the top_k best of them are returned by generate_candidates. The coarse template is taken
+ * from the frame given to the constructor, so it has to be called before the first tracking step.
+ * Levels are reduced if the coarse box would be smaller than one HOG block (16 pixels).
+ *
+ * \levels amount of pyramid levels (0 - the whole candidates grid is scored)
+ * \top_k amount of best coarse candidates refined on the full resolution
+ */
+void GradientBasedTracker::configure_pyramid(int levels, int top_k)
+{
+	pyramid.configure(levels, top_k, last_prediction.size(), 16);
+	if (pyramid.levels == 0){
+		return;
+	}
+	pyramid.downsample(actual_frame, search_region, coarse_frame);
+	Rect coarse_box = pyramid.coarse_rect(last_prediction);
+	coarse_extractor.configure(coarse_box.size(), bins_param);
+	coarse_gt_hist = coarse_extractor.compute(coarse_frame(coarse_box), normalization).clone();
+}
+
+/**
+ * Function pyramid_candidates scores coarse candidates (L2 distance of coarse descriptors to coarse_gt_hist)
+ * and returns full resolution candidates around the best top_k of them (the capture range is the same as
+ * the one of the candidates grid)
+ */
+vector<Rect>  GradientBasedTracker::pyramid_candidates(void)
+{
+	int reach = p_stride*(cand_param/2);
+	pyramid.downsample(actual_frame, search_region, coarse_frame);
+
+	vector<Rect> coarse_candidates = pyramid.coarse_grid(last_prediction, reach, p_stride);
+	discard_out_of_frame(coarse_candidates);
+	vector<double> scores(coarse_candidates.size(), DBL_MAX);
+	for (size_t i = 0; i < coarse_candidates.size(); i++){
+		Rect rectangle = pyramid.coarse_rect(coarse_candidates[i]);
+		if (pyramid.fits(rectangle, coarse_frame.size())){
+			scores[i] = norm( coarse_gt_hist, coarse_extractor.compute(coarse_frame(rectangle), normalization));
+		}
+	}
+
+	vector<Rect> candidates = pyramid.refine(coarse_candidates, scores, last_prediction, reach, p_stride);
+	snap_to_cells(candidates);
+	discard_out_of_frame(candidates);
 	return candidates;
 }
 
+/**
+ * Function pattern_candidates searches the frame with the block-matching pattern of search_strategy: every step
+ * probes the pattern around the best candidate so far (scored by best_candidate_index, the centre first so it wins
+ * ties), moves to the best probe and contracts, until the pattern cannot improve. Probes lie on the candidates grid
+ * within its capture range. Returns only the winner (so find_best_candidate of the tracking step just confirms it).
+ */
+vector<Rect>  GradientBasedTracker::pattern_candidates(void)
+{
+	pattern.start(search_strategy, last_prediction, p_stride*(cand_param/2), p_stride);
+	while (!pattern.finished()){
+		vector<Rect> probes = pattern.probes();
+		discard_out_of_frame(probes);
+		if (probes.empty()){
+			break;
+		}
+		// probes are scored without moving last_prediction, nearest the current centre first
+		pattern.update(probes, probes[best_candidate_index(probes, pattern.centre.tl())]);
+	}
+	return vector<Rect>(1, pattern.centre);
+}
+
 /**
  * Function find_best_candidate calculates histograms, scores them all with L2 (Euclidean) distance
  * and selects best candidate, taking rectangle that has minimal L2 distance (to ground truth
  * histogram gt_hist obtained from first frame)
+ * With hog_precision 1 and 2 distances are computed on int8 or fp16 blocks, quantized once per frame
+ * (precision_check compares the chosen candidate with the one of float distances); only unnormalized blocks
+ * of hog_mode 1 and 2 are shared, otherwise float distances are used, quantizing every descriptor being slower.
+ * With hog_batch (and float precision) descriptors are stacked and all distances come from norm expansion and gemm.
+ * With early_termination (float precision, not batched) candidates nearest last_prediction (the anchor) are scored first
+ * and the rest are abandoned as soon as their partial distance exceeds the best one so far.
+ * If the PCA subspace of blocks was learned (pca_dimensions), distances are computed between projected blocks instead.
+ * If the track is densely matched (dense_scoring), distances of candidates are read from the correlation surface
+ * of the frame (no descriptors; distances of cell features, not HOG L2 distances).
  *
  *  \candidates vector of candidates
  *  \return the candidate rectangle that will be object's final prediction for tracked frame
  */
 Rect GradientBasedTracker::find_best_candidate(vector<Rect> candidates){
-	vector<double> hist_comp_scores;
-	Mat candidate_hist;
+	// returning the best candidate for actual frame tracking
+	last_prediction = candidates[best_candidate_index(candidates, last_prediction.tl())];
+	return last_prediction;
+}
+
+/**
+ * Function best_candidate_index scores candidates the way find_best_candidate describes and returns the index
+ * of the best one, without moving last_prediction
+ *
+ *  \candidates vector of candidates
+ *  \anchor point, nearest which candidates are scored first (early_termination)
+ */
+int GradientBasedTracker::best_candidate_index(const vector<Rect> &candidates, Point anchor){
+	vector<double> hist_comp_scores(candidates.size(), DBL_MAX);
+	vector<double> float_scores(precision_check ? candidates.size() : 0, DBL_MAX);
+
+	// distances of all windows were computed at once for the frame
+	if (dense_scoring() && !candidates.empty()){
+		for (size_t i = 0; i < candidates.size(); i++){
+			hist_comp_scores[i] = dense_matcher.distance(candidates[i].x, candidates[i].y);
+		}
+		int minElementIndex = min_element(hist_comp_scores.begin(),hist_comp_scores.end()) - hist_comp_scores.begin();
+		return minElementIndex;
+	}
+
+	// reduced precision only on blocks of the frame quantized once, not on every normalized descriptor
+	bool reduced_scoring = hog_precision != 0 && !normalization && hog_mode != 0;
+	// template quantized once for the reduced precision
+	if (reduced_scoring && reduced_l2.precision != hog_precision){
+		reduced_l2.set_template(gt_hist, hog_precision);
+	}
+
+	// distances in the PCA subspace of blocks, blocks of the frame projected once
+	bool projected_scoring = hog_pca.components > 0;
+	// all distances at once, descriptors stacked in chunks
+	bool batch_scoring = hog_batch && !reduced_scoring && !projected_scoring;
+	if (batch_scoring){
+		batch_l2.begin();
+	}
+	// candidates abandoned as soon as they cannot beat the best one, promising candidates first
+	bool bounded_scoring = early_termination && !reduced_scoring && !batch_scoring && !projected_scoring;
+	vector<int> order = scoring_order(candidates, bounded_scoring, anchor);
+	double best_distance = DBL_MAX;
 
 	//iterating through all candidates
-	for (auto it = begin (candidates); it != end (candidates); ++it) {
-		// calculating histogram of candidate
-		candidate_hist = calculate_HOG(*it);
+	for (size_t i = 0; i < order.size(); i++) {
+		int index = order[i];
+		if (projected_scoring){
+			// L2 distance in the PCA subspace of blocks (projected blocks of the frame or of the descriptor)
+			hist_comp_scores[index] = projected_HOG_distance(candidates[index]);
+			continue;
+		}
+		if (reduced_scoring){
+			// L2 distance on quantized blocks of the frame (or the quantized descriptor)
+			hist_comp_scores[index] = reduced_HOG_distance(candidates[index]);
+			if (precision_check){
+				float_scores[index] = norm( gt_hist, compute_HOG(candidates[index]));
+			}
+			continue;
+		}
+		// calculating histogram of candidate (reusable extractor, no copy)
+		const Mat & candidate_hist = compute_HOG(candidates[index]);
 
+		if (batch_scoring){
+			batch_l2.add(candidate_hist);
+			continue;
+		}
+		if (bounded_scoring){
+			hist_comp_scores[index] = bounded_l2.distance(gt_hist, candidate_hist, best_distance);
+			best_distance = std::min(best_distance, hist_comp_scores[index]);
+			continue;
+		}
 
 	//computing L2 (Euclidean) distance between ground true histogram and obtained candidate histogram
-		hist_comp_scores.push_back(norm( gt_hist, candidate_hist));
+		hist_comp_scores[index] = norm( gt_hist, candidate_hist);
+	}
+	if (batch_scoring){
+		const vector<double> & scores = batch_l2.finish();
+		hist_comp_scores.assign(scores.begin(), scores.end());
+	}
+	if (reduced_scoring && precision_check && !projected_scoring){
+		reduced_l2.check_argmin(hist_comp_scores, float_scores);
 	}
 	// finding index of candidate, which has the smallest distance from the ground through histogram gt_hist
 	int minElementIndex = min_element(hist_comp_scores.begin(),hist_comp_scores.end()) - hist_comp_scores.begin();
-	// returning the best candidate for actual frame tracking
-	last_prediction = candidates[minElementIndex];
-	return last_prediction;
+	return minElementIndex;
 }
 
 
@@ -170,16 +435,40 @@ Rect GradientBasedTracker::find_best_candidate(vector<Rect> candidates){
 /**
  * Function execute_tracking_step conducts tracker step for every frame. Firstly it extracts channel of interest from the frame,
  * later it generates candidates and finally scores them and chooses the best rectangle-candidate, which is returned as the
- * result of tracking
+ * result of tracking (candidates are kept in step_candidates).
+ * With kalman_search the search is moved to the position predicted by the Kalman filter before the conversion
+ * (predict_search_window).
  */
 Rect GradientBasedTracker::execute_tracking_step(Mat frame)
 {
+	// search centred on the position predicted by the constant-velocity model, the grid covers its uncertainty
+	if (kalman_search){
+		predict_search_window(frame.size());
+	}
 	//extracts channel of interest from the frame
 	convert_RGB_to_channel(frame);
 	//generates candidates
-	vector<Rect> list_candidates = generate_candidates();
+	step_candidates = generate_candidates();
 	//scores candidates and return the best one
-	return find_best_candidate(list_candidates);
+	return find_best_candidate(step_candidates);
+}
+
+/**
+ * Function predict_search_window corrects the Kalman filter with the previous result, moves last_prediction
+ * to the predicted position (clamped to candidate_origins) and sets cand_param from the innovation covariance
+ * (at most cand_param_max), so the search region and candidates grid are placed around the prediction
+ *
+ * \frame_size size of the actual frame
+ */
+void GradientBasedTracker::predict_search_window(Size frame_size)
+{
+	Point predicted = motion.step(last_prediction.tl());
+	// the box is kept where discard_out_of_frame keeps candidates
+	Rect origins = candidate_origins(frame_size);
+	predicted.x = std::min(std::max(predicted.x, origins.x), origins.x + origins.width - 1);
+	predicted.y = std::min(std::max(predicted.y, origins.y), origins.y + origins.height - 1);
+	last_prediction = Rect(predicted, last_prediction.size());
+	cand_param = motion.grid_side(p_stride, cand_param_max);
 }
 
 /**
@@ -192,32 +481,98 @@ Rect GradientBasedTracker::execute_tracking_step(Mat frame)
  */
 Mat GradientBasedTracker::calculate_HOG(Rect rectangle)
 {
-	Mat img_to_compute = actual_frame(rectangle);
-	HOGDescriptor hog;
-	vector< float > descriptors;
-
-	//Setting bins amount parameter
-	hog.nbins = bins_param;
+	//copy of the descriptor, which stays valid after next candidates are computed
+	return compute_HOG(rectangle).clone();
+}
 
-	//Making winSize divisible by 8, required by default parameters of HOG algorithm
-	hog.winSize = img_to_compute.size() / 8 * 8;
+/**
+ * Function compute_HOG creates histogram of descriptors of the candidate with the tracker's HOG extractor
+ * (configured once per track and reused, thus no descriptor set up nor output allocation per candidate).
+ * In hog_mode 1 the descriptor is assembled from the gradient field of the frame, if it covers the candidate.
+ * In hog_mode 2 it is assembled from cells of integral orientation histograms; rectangles out of the search region
+ * get their own gradients and integral histograms (outside_field and outside_orientation, the frame ones are kept),
+ * since such descriptors differ from hog.compute ones.
+ * With hog_cache blocks (and cells in hog_mode 2) are shared between candidates (their origins are snapped
+ * to the cell lattice by snap_to_cells, the descriptor is always the one of the given rectangle).
+ *
+ *  \rectangle candidate, for which there will be calculated HOG histogram
+ *
+ *  \return HOG histogram, valid until the next call
+ */
+const Mat & GradientBasedTracker::compute_HOG(Rect rectangle)
+{
+	// rectangles out of the candidates grid (e.g. ground truth) need their own conversion
+	convert_outside_region(rectangle);
 
-	//Computing descriptor for candidate rectangle image
-	hog.compute(img_to_compute, descriptors);
+	if (hog_mode == 1 && gradient_field.covers(rectangle)){
+		return gradient_field.compute_descriptor(rectangle, normalization);
+	}
+	if (hog_mode == 2){
+		if (!integral_orientation.covers(rectangle)){
+			// scratch gradients and integral histograms of the rectangle, the ones of the frame (and caches) stay intact
+			outside_field.compute(actual_frame, Rect(rectangle.x - 1, rectangle.y - 1, rectangle.width + 2, rectangle.height + 2));
+			outside_orientation.build(outside_field);
+			return outside_orientation.compute_descriptor(rectangle, normalization);
+		}
+		return integral_orientation.compute_descriptor(rectangle, normalization);
+	}
+	return hog_extractor.compute(actual_frame(rectangle), normalization);
+}
 
-	//Mapping vector<float> to Mat
-	Mat candidate_hist = Mat(descriptors, true);
+/**
+ * Function reduced_HOG_distance computes L2 distance of the candidate descriptor to the template in hog_precision.
+ * Without normalization the descriptor is the concatenation of blocks, so in hog_mode 1 and 2 the distance is summed
+ * over blocks of the frame quantized at their first use (shared by all candidates); candidates outside the gradient
+ * field have their descriptor computed and quantized (it is used only without normalization and in hog_mode 1 and 2).
+ *
+ *  \rectangle candidate
+ */
+double GradientBasedTracker::reduced_HOG_distance(Rect rectangle)
+{
+	if (!normalization && hog_mode == 1 && gradient_field.covers(rectangle)){
+		return reduced_l2.distance_of_blocks(gradient_field, rectangle);
+	}
+	if (!normalization && hog_mode == 2 && integral_orientation.covers(rectangle)){
+		return reduced_l2.distance_of_blocks(integral_orientation, rectangle);
+	}
+	return reduced_l2.distance(compute_HOG(rectangle));
+}
 
-	//normalizing histogram, if demanded in parameters
-	if (normalization){
-		normalize( candidate_hist, candidate_hist, 0.01, 1, NORM_MINMAX, -1, Mat() );
+/**
+ * Function projected_HOG_distance computes L2 distance of the candidate descriptor to the template in the PCA subspace
+ * of blocks. Without normalization the descriptor is the concatenation of blocks, so in hog_mode 1 and 2 the distance
+ * is summed over blocks of the frame projected at their first use (shared by all candidates); candidates outside
+ * the gradient field have their descriptor computed and its blocks projected (the subspace is learned only without
+ * normalization and in hog_mode 1 and 2).
+ *
+ *  \rectangle candidate
+ */
+double GradientBasedTracker::projected_HOG_distance(Rect rectangle)
+{
+	if (!normalization && hog_mode == 1 && gradient_field.covers(rectangle)){
+		return hog_pca.distance_of_blocks(gradient_field, rectangle);
+	}
+	if (!normalization && hog_mode == 2 && integral_orientation.covers(rectangle)){
+		return hog_pca.distance_of_blocks(integral_orientation, rectangle);
 	}
+	return hog_pca.distance(compute_HOG(rectangle));
+}
 
-	return candidate_hist;
+/**
+ * Function hog_cache_hit_rate returns the share of blocks of candidates descriptors, which were already computed
+ * for other candidates of the same frame (all frames so far, hog_cache in hog_mode 1 and 2)
+ */
+double GradientBasedTracker::hog_cache_hit_rate(void)
+{
+	return hog_mode == 2 ? integral_orientation.block_cache.hit_rate() : gradient_field.block_cache.hit_rate();
 }
 
 /**
  * Function convert_RGB_to_channel extracts appropriate channel from the frame, type of channel depends from parameter channel_id
+ * (fused conversion, no intermediate HSV image nor split planes are created)
+ * Only the search region (bounding box of all candidates around last_prediction) is converted, the rest of actual_frame
+ * is left untouched. The frame is not copied: it has to stay undrawn until the next call,
+ * since pixels out of the search region are converted from it on demand.
  * Channel_id - channel mapping
  * 0 - gray
  * 1 - H from HSV
@@ -225,37 +580,109 @@ Mat GradientBasedTracker::calculate_HOG(Rect rectangle)
  * 3 - B from BGR
  * 4 - G from BGR
  * 5 - R from BGR
+ * In hog_mode 1 and 2 it also computes gradients of the search region, shared by all candidates descriptors
+ * (and with dense_scoring the distance surface of all windows of the search region)
  */
 void GradientBasedTracker::convert_RGB_to_channel(Mat frame)
 {
-	Mat split_frame[3];
-
-	switch(channel) {
-	   case 0  :
-		   cvtColor(frame, actual_frame, cv::COLOR_BGR2GRAY);
-		   break;
-	   case 1  :
-		   cvtColor(frame, actual_frame, cv::COLOR_BGR2HSV);
-		   split(actual_frame, split_frame);
-		   actual_frame = split_frame[0];
-		   break;
-	   case 2 :
-		   cvtColor(frame, actual_frame, cv::COLOR_BGR2HSV);
-		   split(actual_frame, split_frame);
-		   actual_frame = split_frame[1];
-	   	   break;
-	   case 3:
-		   split(frame, split_frame);
-		   actual_frame = split_frame[0];
-	   	   break;
-	   case 4:
-		   split(frame, split_frame);
-		   actual_frame = split_frame[1];
-	   	   break;
-	   case 5:
-		   split(frame, split_frame);
-		   actual_frame = split_frame[2];
-	   	   break;
+	// header of the caller's frame (no copy), read only by convert_outside_region
+	current_frame = frame;
+	search_region = compute_search_region(frame.size());
+
+	// actual_frame keeps the size of the frame (allocated once), only the region is written
+	actual_frame.create(frame.size(), CV_8U);
+	Mat region_channel = actual_frame(search_region);
+	//computing only the requested plane, in one pass over the region
+	extractChannelOfInterest(frame(search_region), channel, region_channel);
+
+	bool dense = dense_scoring();
+
+	// gradients of the search region, computed once for all candidates
+	if (hog_mode != 0 || dense){
+		gradient_field.caching = hog_cache && hog_mode == 1;
+		integral_orientation.caching = hog_cache && hog_mode == 2;
+		gradient_field.compute(actual_frame, search_region);
+		// integral orientation histograms of the search region
+		if (hog_mode == 2){
+			integral_orientation.build(gradient_field);
+		}
+		// quantized and projected blocks of the previous frame are not valid any more
+		if (hog_precision != 0 && !normalization){
+			reduced_l2.reset_blocks(gradient_field.region, 4*bins_param);
+		}
+		if (hog_pca.components > 0){
+			hog_pca.reset_blocks(gradient_field.region);
+		}
+		// distances of all windows (the template is set in the constructor, after the first conversion)
+		if (dense){
+			dense_matcher.match(gradient_field);
+		}
 	}
 }
 
+/**
+ * Function dense_scoring tells, if frames are scored by the dense matching surface: dense matching was chosen
+ * for the track in the constructor and the whole grid is scored (no pattern search nor pyramid), which main sets
+ * before tracking, so the answer is the same in every frame of the track
+ */
+bool GradientBasedTracker::dense_scoring(void) const
+{
+	return dense_matching && search_strategy == 0 && pyramid.levels == 0;
+}
+
+/**
+ * Function scoring_order returns indexes of candidates in the order they are scored: nearest the anchor first
+ * (the object moves little between frames, so these candidates are the likely winners), otherwise as generated
+ *
+ * \candidates vector of candidates
+ * \nearest_first tells, if candidates are sorted by their distance to the anchor
+ * \anchor the predicted position (last_prediction of the tracking step, or the centre of the search pattern)
+ */
+vector<int> GradientBasedTracker::scoring_order(const vector<Rect> &candidates, bool nearest_first, Point anchor)
+{
+	vector<int> order(candidates.size());
+	for (size_t i = 0; i < order.size(); i++){
+		order[i] = (int)i;
+	}
+	if (nearest_first){
+		stable_sort(order.begin(), order.end(), [&candidates, anchor](int a, int b){
+			Point da = candidates[a].tl() - anchor, db = candidates[b].tl() - anchor;
+			return da.dot(da) < db.dot(db);
+		});
+	}
+	return order;
+}
+
+/**
+ * Function compute_search_region returns the bounding box of the candidates grid generated around last_prediction
+ * (generate_candidates shifts the box at most (cand_param/2)*p_stride pixels in every direction), clipped to the frame.
+ * It is extended by one pixel, since HOG gradients of the candidate read its neighbouring pixels.
+ *
+ * \frame_size size of the actual frame
+ *
+ * \return the part of the frame, which is read by candidates descriptors
+ */
+Rect GradientBasedTracker::compute_search_region(Size frame_size)
+{
+	int reach = p_stride*(cand_param/2) + 1;
+	Rect region(last_prediction.x - reach, last_prediction.y - reach,
+			last_prediction.width + 2*reach, last_prediction.height + 2*reach);
+	return region & Rect(Point(0, 0), frame_size);
+}
+
+/**
+ * Function convert_outside_region converts the rectangle (with its one pixel border) from the frame given to
+ * convert_RGB_to_channel, if it does not lie inside the search region (e.g. ground truth rectangle used for visualisation)
+ *
+ * \rectangle the rectangle which will be read from actual_frame
+ */
+void GradientBasedTracker::convert_outside_region(Rect rectangle)
+{
+	Rect area = Rect(rectangle.x - 1, rectangle.y - 1, rectangle.width + 2, rectangle.height + 2) &
+			Rect(Point(0, 0), actual_frame.size());
+	if ((area & search_region) == area || current_frame.empty()){
+		return;
+	}
+	Mat area_channel = actual_frame(area);
+	extractChannelOfInterest(current_frame(area), channel, area_channel);
+}
@@ -0,0 +1,1334 @@
+/* Applied Video Sequence Analysis (AVSA)
+ *
+ *	LAB4: HOGEngine
+ *	HOGEngine.cpp
+ *
+ * 	Authors: Sergio Romero & Jan Sieradzki
+ *	IPCV & I2ICSI - 2021
+ */
+
+#include "HOGEngine.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <cfloat>
+#include <cmath>
+
+// x86 vector kernels are compiled for their instruction set by target attributes and chosen at run time
+// (__builtin_cpu_supports), so the object file runs on any CPU of the architecture without special compiler flags.
+// Every CPU with AVX2 has F16C too, thus the fp16 kernel is chosen by the AVX2 check.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HOG_X86_KERNELS
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX2_F16C __attribute__((target("avx2,f16c")))
+#endif
+
+using namespace cv;
+using namespace std;
+using namespace tracker;
+
+// constructor
+HOGExtractor::HOGExtractor(void)
+{
+}
+
+/**
+ * Function configure sets up the HOG descriptor for boxes of the size. Candidates of one frame (and of the whole track)
+ * share the size, so it is done once, not for every candidate.
+ *
+ * \box_size size of the candidates rectangles
+ * \bins amount of bins in orientation histograms
+ */
+void HOGExtractor::configure(Size box_size, int bins)
+{
+	if (box_size == configured_size && hog.nbins == bins){
+		return;
+	}
+	configured_size = box_size;
+
+	//Setting bins amount parameter
+	hog.nbins = bins;
+
+	//Making winSize divisible by 8, required by default parameters of HOG algorithm
+	hog.winSize = box_size / 8 * 8;
+}
+
+/**
+ * Function compute calculates HOG descriptor of the box image, the same which a fresh HOGDescriptor with
+ * the same parameters computes, but without setting the descriptor up and without allocating its output
+ *
+ * \image box image (gray or channel of interest)
+ * \normalization tells, if descriptor should be normalized (NORM_MINMAX to [0.01, 1])
+ *
+ * \return descriptor (descriptor size x 1, CV_32F), valid until the next call
+ */
+const Mat & HOGExtractor::compute(const Mat &image, bool normalization)
+{
+	configure(image.size(), hog.nbins);
+
+	//Computing descriptor for candidate rectangle image
+	hog.compute(image, descriptors);
+
+	//Mapping vector<float> to Mat (no copy)
+	descriptor = Mat(descriptors, false);
+
+	//normalizing histogram, if demanded in parameters
+	if (normalization){
+		normalize( descriptor, descriptor, 0.01, 1, NORM_MINMAX, -1, Mat() );
+	}
+	return descriptor;
+}
+
+// HOG parameters of default HOGDescriptor, which the gradient field assumes
+#define HOG_CELL 8
+#define HOG_BLOCK 16
+
+/**
+ * Function normalize_block_L2Hys normalizes the block histogram like HOGDescriptor does: L2 normalization,
+ * clipping of values to the threshold and L2 normalization again
+ *
+ * \hist block histogram
+ * \size amount of values in block histogram
+ * \threshold clipping threshold (L2HysThreshold)
+ */
+void tracker::normalize_block_L2Hys(float * hist, int size, float threshold)
+{
+	float sum = 0;
+	for (int b = 0; b < size; b++){
+		sum += hist[b]*hist[b];
+	}
+	float scale = 1.f/(std::sqrt(sum) + size*0.1f);
+	sum = 0;
+	for (int b = 0; b < size; b++){
+		hist[b] = std::min(hist[b]*scale, threshold);
+		sum += hist[b]*hist[b];
+	}
+	scale = 1.f/(std::sqrt(sum) + 1e-3f);
+	for (int b = 0; b < size; b++){
+		hist[b] *= scale;
+	}
+}
+
+// constructor
+OriginCache::OriginCache(void)
+{
+	size = 0;
+	hits = 0;
+	misses = 0;
+}
+
+/**
+ * Function reset forgets histograms of the previous frame (counters are kept)
+ *
+ * \key_region region of the frame, where histograms can start
+ * \value_size amount of values of one histogram
+ */
+void OriginCache::reset(Rect key_region, int value_size)
+{
+	region = key_region;
+	size = value_size;
+	slots.assign((size_t)std::max(region.area(), 0), -1);
+	values.clear();
+}
+
+/**
+ * Function insert adds the histogram with top left corner (x, y)
+ *
+ * \return values of the histogram to be filled in by the caller
+ */
+float * OriginCache::insert(int x, int y)
+{
+	int slot = values.size()/size;
+	slots[(y - region.y)*region.width + (x - region.x)] = slot;
+	values.resize(values.size() + size);
+	return &values[(size_t)slot*size];
+}
+
+/**
+ * Function hit_rate returns the share of lookups, which found the histogram already computed
+ */
+double OriginCache::hit_rate(void) const
+{
+	return hits + misses > 0 ? (double)hits/(hits + misses) : 0;
+}
+
+/**
+ * Function cell_snap_pitch returns the pitch, to which candidates origins are snapped so they share cells:
+ * the stride itself if it divides the cell size, otherwise the largest divisor of the cell size below the stride
+ *
+ * \stride pixel distance between candidates of the grid
+ */
+int tracker::cell_snap_pitch(int stride)
+{
+	int pitch = 1;
+	for (int divisor = 1; divisor <= HOG_CELL; divisor *= 2){
+		if (divisor <= stride){
+			pitch = divisor;
+		}
+	}
+	return pitch;
+}
+
+/**
+ * Function snap_to_lattice moves the rectangle to the nearest point anchor + k*pitch (size is kept)
+ */
+Rect tracker::snap_to_lattice(Rect rectangle, Point anchor, int pitch)
+{
+	rectangle.x = anchor.x + cvRound((double)(rectangle.x - anchor.x)/pitch)*pitch;
+	rectangle.y = anchor.y + cvRound((double)(rectangle.y - anchor.y)/pitch)*pitch;
+	return rectangle;
+}
+
+// constructor
+GradientField::GradientField(void)
+{
+	bins_param = 0;
+	caching = false;
+	fast_kernel = false;
+}
+
+/**
+ * Function configure prepares weights of every pixel of the block for each of its 4 cells, the same HOGDescriptor
+ * uses: Gaussian window of the block (sigma = getWinSigma()) times bilinear interpolation between centres of cells.
+ * Cells are ordered column by column, like in HOGDescriptor.
+ *
+ * \bins amount of orientation bins
+ */
+void GradientField::configure(int bins)
+{
+	bins_param = bins;
+	hog.nbins = bins;
+
+	float sigma = (float)hog.getWinSigma();
+	float scale = 1.f/(sigma*sigma*2);
+	cell_weights.assign(4*HOG_BLOCK*HOG_BLOCK, 0.f);
+	for (int i = 0; i < HOG_BLOCK; i++){
+		for (int j = 0; j < HOG_BLOCK; j++){
+			float di = i - HOG_BLOCK*0.5f, dj = j - HOG_BLOCK*0.5f;
+			float gaussian = std::exp(-(di*di + dj*dj)*scale);
+			float cell_x = (j + 0.5f)/HOG_CELL - 0.5f;
+			float cell_y = (i + 0.5f)/HOG_CELL - 0.5f;
+			int cell_x0 = cvFloor(cell_x), cell_y0 = cvFloor(cell_y);
+			cell_x -= cell_x0;
+			cell_y -= cell_y0;
+			for (int cx = cell_x0; cx <= cell_x0 + 1; cx++){
+				for (int cy = cell_y0; cy <= cell_y0 + 1; cy++){
+					if (cx < 0 || cx > 1 || cy < 0 || cy > 1){
+						continue;
+					}
+					float wx = cx == cell_x0 ? 1.f - cell_x : cell_x;
+					float wy = cy == cell_y0 ? 1.f - cell_y : cell_y;
+					cell_weights[((cx*2 + cy)*HOG_BLOCK + i)*HOG_BLOCK + j] = gaussian*wx*wy;
+				}
+			}
+		}
+	}
+
+	// directions of bins centres (k + 0.5)*pi/bins for k = -1 .. bins (unsigned gradients, like HOGDescriptor)
+	bin_directions.resize(2*(bins_param + 2));
+	for (int k = -1; k <= bins_param; k++){
+		double angle = (k + 0.5)*CV_PI/bins_param;
+		bin_directions[2*(k + 1)] = (float)std::cos(angle);
+		bin_directions[2*(k + 1) + 1] = (float)std::sin(angle);
+	}
+}
+
+/**
+ * Function bin_gradient splits the gradient (dx, dy) between its two orientation bins without atan2: the gradient
+ * is folded to the upper half plane, its lower bin is the last bin centre it is not below (cross product with
+ * the centre direction >= 0), and the weights of both bins are the sines of angles to the two centres
+ * (the cross products), so they are interpolated in proportion to the angular distances like in HOGDescriptor.
+ * Scalar version of the kernel of compute_fast (used for border pixels and without AVX2).
+ *
+ * \directions unit vectors of centres of bins -1 .. bins
+ * \grad two magnitude parts (lower and upper bin)
+ * \qangle two orientation bins
+ */
+static inline void bin_gradient(int dx, int dy, const float * directions, int bins, float * grad, uchar * qangle)
+{
+	if (dy < 0 || (dy == 0 && dx < 0)){
+		dx = -dx;
+		dy = -dy;
+	}
+	// lower bin centre and the direction of the upper one
+	int count = 0;
+	float lower = directions[0]*dy - directions[1]*dx;
+	while (count < bins && directions[2*(count + 1)]*dy - directions[2*(count + 1) + 1]*dx >= 0){
+		count++;
+		lower = directions[2*count]*dy - directions[2*count + 1]*dx;
+	}
+	float upper = directions[2*(count + 1) + 1]*dx - directions[2*(count + 1)]*dy;
+	float magnitude = std::sqrt((float)(dx*dx + dy*dy));
+	float scale = magnitude/std::max(lower + upper, FLT_MIN);
+	grad[0] = upper*scale;
+	grad[1] = lower*scale;
+	qangle[0] = (uchar)(count == 0 ? bins - 1 : count - 1);
+	qangle[1] = (uchar)(count == bins ? 0 : count);
+}
+
+/**
+ * Function gradient_row_avx2 is the AVX2 kernel of compute_fast: it bins gradients of 8 pixels per iteration
+ * (called only if the CPU supports AVX2)
+ *
+ * \up, row, down rows of the image above, at and below the region row, starting at the region column
+ * \j first pixel of the region row to be computed (its left neighbour has to be inside the image)
+ * \j_to end of pixels, whose right neighbour is inside the image
+ * \grad_row, qangle_row rows of grad and qangle of the region
+ *
+ * \return first pixel, which was not computed (less than 8 pixels before j_to)
+ */
+TARGET_AVX2 static int gradient_row_avx2(const uchar * up, const uchar * row, const uchar * down, int j, int j_to,
+		const float * directions, int bins_param, float * grad_row, uchar * qangle_row)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256i bins = _mm256_set1_epi32(bins_param);
+	for (; j + 8 <= j_to; j += 8){
+		// int16 derivatives of 8 pixels, folded to the upper half plane
+		__m128i dx = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(row + j + 1))),
+				_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(row + j - 1))));
+		__m128i dy = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(down + j))),
+				_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(up + j))));
+		__m128i fold = _mm_or_si128(_mm_cmplt_epi16(dy, zero), _mm_and_si128(_mm_cmpeq_epi16(dy, zero), _mm_cmplt_epi16(dx, zero)));
+		dx = _mm_sub_epi16(_mm_xor_si128(dx, fold), fold);
+		dy = _mm_sub_epi16(_mm_xor_si128(dy, fold), fold);
+		__m256i dx32 = _mm256_cvtepi16_epi32(dx), dy32 = _mm256_cvtepi16_epi32(dy);
+		__m256 fx = _mm256_cvtepi32_ps(dx32), fy = _mm256_cvtepi32_ps(dy32);
+
+		// lower bin centre (cross product of the last centre not above the gradient) and the upper centre
+		__m256i count = _mm256_setzero_si256();
+		__m256 lower = _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(directions[0]), fy), _mm256_mul_ps(_mm256_set1_ps(directions[1]), fx));
+		__m256 upper_x = _mm256_set1_ps(directions[2]), upper_y = _mm256_set1_ps(directions[3]);
+		for (int k = 1; k <= bins_param; k++){
+			__m256 cos_k = _mm256_set1_ps(directions[2*k]), sin_k = _mm256_set1_ps(directions[2*k + 1]);
+			__m256 cross = _mm256_sub_ps(_mm256_mul_ps(cos_k, fy), _mm256_mul_ps(sin_k, fx));
+			__m256 above = _mm256_cmp_ps(cross, _mm256_setzero_ps(), _CMP_GE_OQ);
+			lower = _mm256_blendv_ps(lower, cross, above);
+			upper_x = _mm256_blendv_ps(upper_x, _mm256_set1_ps(directions[2*(k + 1)]), above);
+			upper_y = _mm256_blendv_ps(upper_y, _mm256_set1_ps(directions[2*(k + 1) + 1]), above);
+			count = _mm256_sub_epi32(count, _mm256_castps_si256(above));
+		}
+		__m256 upper = _mm256_sub_ps(_mm256_mul_ps(upper_y, fx), _mm256_mul_ps(upper_x, fy));
+
+		// magnitude from the approximated reciprocal square root (exact 0 for flat pixels)
+		__m256 squares = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_mullo_epi32(dx32, dx32), _mm256_mullo_epi32(dy32, dy32)));
+		__m256 magnitude = _mm256_mul_ps(squares, _mm256_rsqrt_ps(_mm256_max_ps(squares, one)));
+		__m256 scale = _mm256_div_ps(magnitude, _mm256_max_ps(_mm256_add_ps(lower, upper), _mm256_set1_ps(FLT_MIN)));
+		__m256 grad0 = _mm256_mul_ps(upper, scale), grad1 = _mm256_mul_ps(lower, scale);
+
+		// bins of lower and upper centres, wrapped around
+		__m256i bin0 = _mm256_sub_epi32(count, _mm256_set1_epi32(1));
+		bin0 = _mm256_add_epi32(bin0, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), bin0), bins));
+		__m256i bin1 = _mm256_andnot_si256(_mm256_cmpeq_epi32(count, bins), count);
+
+		// interleaving (pixel, bin) pairs in the layout of computeGradient
+		__m256 pairs_low = _mm256_unpacklo_ps(grad0, grad1), pairs_high = _mm256_unpackhi_ps(grad0, grad1);
+		_mm256_storeu_ps(grad_row + j*2, _mm256_permute2f128_ps(pairs_low, pairs_high, 0x20));
+		_mm256_storeu_ps(grad_row + j*2 + 8, _mm256_permute2f128_ps(pairs_low, pairs_high, 0x31));
+		__m256i bins16 = _mm256_packs_epi32(_mm256_unpacklo_epi32(bin0, bin1), _mm256_unpackhi_epi32(bin0, bin1));
+		__m256i bins8 = _mm256_permute4x64_epi64(_mm256_packus_epi16(bins16, bins16), 0x08);
+		_mm_storeu_si128((__m128i *)(qangle_row + j*2), _mm256_castsi256_si128(bins8));
+	}
+	return j;
+}
+
+/**
+ * Function compute_fast fills grad and qangle of the region (the same layout computeGradient produces) from
+ * the 8-bit image directly: derivatives are int16 differences of the neighbours (reflected at the image border,
+ * like computeGradient does), orientation bins come from comparisons with bins directions (no atan2) and magnitudes
+ * from the approximated reciprocal square root. 8 pixels are processed per AVX2 iteration (gradient_row_avx2, if the CPU
+ * supports it). Gamma correction is not applied, so descriptors are close to, but not the same as, the ones of hog.compute.
+ *
+ * \image frame with the extracted channel (or gray scale, CV_8U), valid inside the search region
+ */
+void GradientField::compute_fast(const Mat &image)
+{
+	CV_Assert(image.type() == CV_8U);
+	grad.create(region.size(), CV_32FC2);
+	qangle.create(region.size(), CV_8UC2);
+	const float * directions = &bin_directions[0];
+#ifdef HOG_X86_KERNELS
+	bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+	for (int i = 0; i < region.height; i++){
+		int y = region.y + i;
+		const uchar * up = image.ptr<uchar>(borderInterpolate(y - 1, image.rows, BORDER_REFLECT_101));
+		const uchar * row = image.ptr<uchar>(y);
+		const uchar * down = image.ptr<uchar>(borderInterpolate(y + 1, image.rows, BORDER_REFLECT_101));
+		float * grad_row = grad.ptr<float>(i);
+		uchar * qangle_row = qangle.ptr<uchar>(i);
+
+		int j = 0;
+#ifdef HOG_X86_KERNELS
+		if (avx2){
+			// pixels with both horizontal neighbours inside the image
+			int j_from = region.x > 0 ? 0 : 1;
+			int j_to = std::min(region.width, image.cols - 1 - region.x);
+			for (; j < j_from; j++){
+				int x = region.x + j;
+				bin_gradient(row[borderInterpolate(x + 1, image.cols, BORDER_REFLECT_101)] - row[borderInterpolate(x - 1, image.cols, BORDER_REFLECT_101)],
+						down[x] - up[x], directions, bins_param, grad_row + j*2, qangle_row + j*2);
+			}
+			j = gradient_row_avx2(up + region.x, row + region.x, down + region.x, j, j_to, directions, bins_param, grad_row, qangle_row);
+		}
+#endif
+		for (; j < region.width; j++){
+			int x = region.x + j;
+			bin_gradient(row[borderInterpolate(x + 1, image.cols, BORDER_REFLECT_101)] - row[borderInterpolate(x - 1, image.cols, BORDER_REFLECT_101)],
+					down[x] - up[x], directions, bins_param, grad_row + j*2, qangle_row + j*2);
+		}
+	}
+}
+
+/**
+ * Function compute calculates gradients with HOGDescriptor::computeGradient, which reads neighbours of the region
+ * from the whole image, like it does for every candidate ROI. The region is the search region without its one pixel
+ * border (the border is read as neighbours), except where the search region touches the image border.
+ *
+ * \image frame with the extracted channel (or gray scale), valid inside the search region
+ * \search_region converted part of the frame
+ */
+void GradientField::compute(const Mat &image, Rect search_region)
+{
+	search_region &= Rect(Point(0, 0), image.size());
+	int x0 = search_region.x > 0 ? search_region.x + 1 : 0;
+	int y0 = search_region.y > 0 ? search_region.y + 1 : 0;
+	int x1 = search_region.br().x < image.cols ? search_region.br().x - 1 : image.cols;
+	int y1 = search_region.br().y < image.rows ? search_region.br().y - 1 : image.rows;
+	region = Rect(Point(x0, y0), Point(std::max(x0, x1), std::max(y0, y1)));
+	block_cache.reset(region, 4*bins_param);
+	if (region.empty()){
+		return;
+	}
+	if (fast_kernel){
+		compute_fast(image);
+		return;
+	}
+	hog.computeGradient(image(region), grad, qangle);
+}
+
+/**
+ * Function covers tells if the HOG window of the rectangle (its size rounded down to multiple of 8) lies inside
+ * the region with computed gradients
+ */
+bool GradientField::covers(Rect rectangle) const
+{
+	Rect window(rectangle.tl(), rectangle.size() / HOG_CELL * HOG_CELL);
+	return !grad.empty() && (window & region) == window;
+}
+
+/**
+ * Function block_histogram accumulates magnitudes of the block pixels to orientation bins of its 4 cells
+ * and normalizes the block histogram with L2Hys, as HOGDescriptor does
+ *
+ * \x left column of the block in frame coordinates
+ * \y top row of the block in frame coordinates
+ * \hist output histogram, 4 x bins_param values
+ */
+void GradientField::block_histogram(int x, int y, float * hist) const
+{
+	int size = 4*bins_param;
+	memset(hist, 0, size*sizeof(float));
+	for (int i = 0; i < HOG_BLOCK; i++){
+		const float * magnitudes = grad.ptr<float>(y - region.y + i) + (x - region.x)*2;
+		const uchar * bins = qangle.ptr<uchar>(y - region.y + i) + (x - region.x)*2;
+		for (int j = 0; j < HOG_BLOCK; j++){
+			float magnitude0 = magnitudes[j*2], magnitude1 = magnitudes[j*2 + 1];
+			int bin0 = bins[j*2], bin1 = bins[j*2 + 1];
+			for (int cell = 0; cell < 4; cell++){
+				float w = cell_weights[(cell*HOG_BLOCK + i)*HOG_BLOCK + j];
+				hist[cell*bins_param + bin0] += magnitude0*w;
+				hist[cell*bins_param + bin1] += magnitude1*w;
+			}
+		}
+	}
+
+	normalize_block_L2Hys(hist, size, (float)hog.L2HysThreshold);
+}
+
+/**
+ * Function cached_block returns normalized histogram of the block, which is computed only by the first candidate
+ * containing it (the block histogram depends only on its origin)
+ */
+const float * GradientField::cached_block(int x, int y)
+{
+	float * hist = block_cache.find(x, y);
+	if (hist == 0){
+		hist = block_cache.insert(x, y);
+		block_histogram(x, y, hist);
+	}
+	return hist;
+}
+
+/**
+ * Function compute_descriptor assembles HOG descriptor of the rectangle from the shared gradients. The values
+ * are the ones hog.compute returns for the rectangle image (up to float rounding), blocks ordered column by column.
+ *
+ * \rectangle candidate in frame coordinates (covers() has to be true)
+ * \normalization tells, if descriptor should be normalized (NORM_MINMAX to [0.01, 1])
+ *
+ * \return descriptor (descriptor size x 1, CV_32F), valid until the next call
+ */
+const Mat & GradientField::compute_descriptor(Rect rectangle, bool normalization)
+{
+	Size window = rectangle.size() / HOG_CELL * HOG_CELL;
+	int blocks_x = std::max((window.width - HOG_BLOCK)/HOG_CELL + 1, 0);
+	int blocks_y = std::max((window.height - HOG_BLOCK)/HOG_CELL + 1, 0);
+	int block_size = 4*bins_param;
+	descriptor.create(blocks_x*blocks_y*block_size, 1, CV_32F);
+
+	float * out = descriptor.ptr<float>();
+	for (int bx = 0; bx < blocks_x; bx++){
+		for (int by = 0; by < blocks_y; by++){
+			if (caching){
+				// gathering the block shared with other candidates
+				const float * hist = cached_block(rectangle.x + bx*HOG_CELL, rectangle.y + by*HOG_CELL);
+				copy(hist, hist + block_size, out);
+			} else {
+				block_histogram(rectangle.x + bx*HOG_CELL, rectangle.y + by*HOG_CELL, out);
+			}
+			out += block_size;
+		}
+	}
+
+	//normalizing histogram, if demanded in parameters
+	if (normalization){
+		normalize( descriptor, descriptor, 0.01, 1, NORM_MINMAX, -1, Mat() );
+	}
+	return descriptor;
+}
+
+// constructor
+IntegralOrientationHistogram::IntegralOrientationHistogram(void)
+{
+	bins_param = 0;
+	threshold = 0;
+	caching = false;
+}
+
+/**
+ * Function build computes integral images of gradient magnitude of every orientation bin over the region
+ * of the gradient field. Every entry (y, x) keeps the magnitudes (both interpolated parts) summed per bin
+ * over the rectangle from region's top left corner to (y, x).
+ *
+ * \gradient_field gradients of the frame
+ */
+void IntegralOrientationHistogram::build(const GradientField &gradient_field)
+{
+	region = gradient_field.region;
+	bins_param = gradient_field.bins_param;
+	threshold = (float)gradient_field.hog.L2HysThreshold;
+	int bins = bins_param;
+
+	int row_len = (region.width + 1)*bins;
+	table.assign((size_t)(region.height + 1)*row_len, 0);
+	cell_cache.reset(region, bins);
+	block_cache.reset(region, 4*bins);
+	if (region.empty()){
+		return;
+	}
+	vector<double> row_sums(bins);
+
+	for (int y = 0; y < region.height; y++){
+		const float * magnitudes = gradient_field.grad.ptr<float>(y);
+		const uchar * orientations = gradient_field.qangle.ptr<uchar>(y);
+		const double * above = &table[(size_t)y*row_len + bins];
+		double * current = &table[(size_t)(y + 1)*row_len + bins];
+		fill(row_sums.begin(), row_sums.end(), 0);
+		// cumulating magnitudes of the row and adding sums of rows above
+		for (int x = 0; x < region.width; x++){
+			row_sums[orientations[x*2]] += magnitudes[x*2];
+			row_sums[orientations[x*2 + 1]] += magnitudes[x*2 + 1];
+			for (int b = 0; b < bins; b++){
+				current[b] = above[b] + row_sums[b];
+			}
+			above += bins;
+			current += bins;
+		}
+	}
+}
+
+/**
+ * Function covers tells if the HOG window of the rectangle (its size rounded down to multiple of 8) lies inside
+ * the region of integral histograms
+ */
+bool IntegralOrientationHistogram::covers(Rect rectangle) const
+{
+	Rect window(rectangle.tl(), rectangle.size() / HOG_CELL * HOG_CELL);
+	return !table.empty() && (window & region) == window;
+}
+
+/**
+ * Function cell_histogram writes orientation histogram of the cell (8 x 8 pixels) to out
+ *
+ * \x left column of the cell in frame coordinates
+ * \y top row of the cell in frame coordinates
+ * \out output histogram, bins_param values
+ */
+void IntegralOrientationHistogram::cell_histogram(int x, int y, float * out) const
+{
+	int row_len = (region.width + 1)*bins_param;
+	int x0 = (x - region.x)*bins_param;
+	int x1 = x0 + HOG_CELL*bins_param;
+	const double * top = &table[(size_t)(y - region.y)*row_len];
+	const double * bottom = top + (size_t)HOG_CELL*row_len;
+	for (int b = 0; b < bins_param; b++){
+		out[b] = (float)(bottom[x1 + b] - bottom[x0 + b] - top[x1 + b] + top[x0 + b]);
+	}
+}
+
+/**
+ * Function block_histogram writes normalized histogram of the block (2 x 2 cells ordered column by column) to out.
+ * With caching, every cell is looked up in integral histograms only once per frame.
+ *
+ * \x left column of the block in frame coordinates
+ * \y top row of the block in frame coordinates
+ * \out output histogram, 4 x bins_param values
+ */
+void IntegralOrientationHistogram::block_histogram(int x, int y, float * out)
+{
+	for (int cell = 0; cell < 4; cell++){
+		int cell_x = x + (cell >> 1)*HOG_CELL, cell_y = y + (cell & 1)*HOG_CELL;
+		float * hist = out + cell*bins_param;
+		if (!caching){
+			cell_histogram(cell_x, cell_y, hist);
+			continue;
+		}
+		const float * cached = cell_cache.find(cell_x, cell_y);
+		if (cached == 0){
+			float * inserted = cell_cache.insert(cell_x, cell_y);
+			cell_histogram(cell_x, cell_y, inserted);
+			cached = inserted;
+		}
+		copy(cached, cached + bins_param, hist);
+	}
+	normalize_block_L2Hys(out, 4*bins_param, threshold);
+}
+
+/**
+ * Function cached_block returns normalized histogram of the block, which is computed only by the first candidate
+ * containing it
+ */
+const float * IntegralOrientationHistogram::cached_block(int x, int y)
+{
+	float * hist = block_cache.find(x, y);
+	if (hist == 0){
+		hist = block_cache.insert(x, y);
+		block_histogram(x, y, hist);
+	}
+	return hist;
+}
+
+/**
+ * Function compute_descriptor assembles HOG descriptor of the rectangle from cells histograms (4 lookups per bin),
+ * so its cost does not depend on pixels of the candidate. Blocks of 2 x 2 cells are L2Hys normalized and ordered
+ * column by column, like in HOGDescriptor, but cells are not weighted by the Gaussian window nor interpolated
+ * between their neighbours, thus descriptors are comparable only with descriptors computed the same way.
+ *
+ * \rectangle candidate in frame coordinates (covers() has to be true)
+ * \normalization tells, if descriptor should be normalized (NORM_MINMAX to [0.01, 1])
+ *
+ * \return descriptor (descriptor size x 1, CV_32F), valid until the next call
+ */
+const Mat & IntegralOrientationHistogram::compute_descriptor(Rect rectangle, bool normalization)
+{
+	Size window = rectangle.size() / HOG_CELL * HOG_CELL;
+	int blocks_x = std::max((window.width - HOG_BLOCK)/HOG_CELL + 1, 0);
+	int blocks_y = std::max((window.height - HOG_BLOCK)/HOG_CELL + 1, 0);
+	int block_size = 4*bins_param;
+	descriptor.create(blocks_x*blocks_y*block_size, 1, CV_32F);
+
+	float * out = descriptor.ptr<float>();
+	for (int bx = 0; bx < blocks_x; bx++){
+		for (int by = 0; by < blocks_y; by++){
+			int x = rectangle.x + bx*HOG_CELL, y = rectangle.y + by*HOG_CELL;
+			if (caching){
+				// gathering the block shared with other candidates
+				const float * hist = cached_block(x, y);
+				copy(hist, hist + block_size, out);
+			} else {
+				block_histogram(x, y, out);
+			}
+			out += block_size;
+		}
+	}
+
+	//normalizing histogram, if demanded in parameters
+	if (normalization){
+		normalize( descriptor, descriptor, 0.01, 1, NORM_MINMAX, -1, Mat() );
+	}
+	return descriptor;
+}
+
+// constructor
+ReducedPrecisionL2::ReducedPrecisionL2(void)
+{
+	precision = 0;
+	block_values = 0;
+	checked_frames = 0;
+	agreeing_frames = 0;
+}
+
+// scale of int8 descriptors values (HOG values, L2Hys or min-max normalized, lie in [0, 1])
+#define INT8_SCALE 127
+
+/**
+ * Function set_template quantizes the template descriptor, candidates are compared with it in the same precision
+ *
+ * \gt_descriptor template descriptor (descriptor size x 1, CV_32F)
+ * \descriptor_precision 1 - int8, 2 - fp16
+ */
+void ReducedPrecisionL2::set_template(const Mat &gt_descriptor, int descriptor_precision)
+{
+	precision = descriptor_precision;
+	quantize(gt_descriptor, gt_quantized);
+	// blocks quantized in the previous precision are not valid any more
+	quantized_blocks.reset(quantized_blocks.region, quantized_blocks.size);
+}
+
+/**
+ * Function quantize converts the float descriptor to int8 (rounded value*127, saturated) or to fp16
+ */
+void ReducedPrecisionL2::quantize(const Mat &descriptor, Mat &out) const
+{
+	if (precision == 1){
+		descriptor.convertTo(out, CV_8S, INT8_SCALE);
+	} else {
+		convertFp16(descriptor, out);
+	}
+}
+
+/**
+ * Function half_to_float converts fp16 value (IEEE half precision bits) to float
+ */
+static inline float half_to_float(ushort half)
+{
+	int exponent = (half >> 10) & 31, mantissa = half & 1023;
+	float value;
+	if (exponent == 0){
+		value = std::ldexp((float)mantissa, -24);
+	} else if (exponent == 31){
+		value = mantissa ? NAN : INFINITY;
+	} else {
+		value = std::ldexp((float)(mantissa | 1024), exponent - 25);
+	}
+	return half & 0x8000 ? -value : value;
+}
+
+#ifdef HOG_X86_KERNELS
+/**
+ * Function squared_difference_int8_avx2 sums squared differences of int8 values by integer multiply-add (16 values per
+ * iteration, called only if the CPU supports AVX2). Differences of int8 values reach +-255 (+-254 for the saturated
+ * quantized ones), so an iteration adds at most 2 x 255^2 to an int32 lane: lanes are moved to the 64-bit sum every
+ * 8192 iterations, below the 16512 they can hold.
+ *
+ * \sum sum, to which the squared differences are added
+ *
+ * \return amount of values summed (the rest is shorter than one vector)
+ */
+TARGET_AVX2 static int squared_difference_int8_avx2(const schar * values, const schar * gt_values, int size, long long &sum)
+{
+	int i = 0;
+	while (i + 16 <= size){
+		int chunk_end = std::min(size, i + 8192*16);
+		__m256i sums = _mm256_setzero_si256();
+		for (; i + 16 <= chunk_end; i += 16){
+			__m256i difference = _mm256_sub_epi16(_mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(values + i))),
+					_mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(gt_values + i))));
+			sums = _mm256_add_epi32(sums, _mm256_madd_epi16(difference, difference));
+		}
+		int lanes[8];
+		_mm256_storeu_si256((__m256i *)lanes, sums);
+		for (int l = 0; l < 8; l++){
+			sum += lanes[l];
+		}
+	}
+	return i;
+}
+
+/**
+ * Function squared_difference_fp16_avx2 sums squared differences of fp16 values widened to float by F16C
+ * (8 values per iteration, called only if the CPU supports AVX2)
+ *
+ * \sum sum, to which the squared differences are added
+ *
+ * \return amount of values summed (the rest is shorter than one vector)
+ */
+TARGET_AVX2_F16C static int squared_difference_fp16_avx2(const ushort * values, const ushort * gt_values, int size, double &sum)
+{
+	int i = 0;
+	__m256 sums = _mm256_setzero_ps();
+	for (; i + 8 <= size; i += 8){
+		__m256 difference = _mm256_sub_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(values + i))),
+				_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(gt_values + i))));
+		sums = _mm256_add_ps(sums, _mm256_mul_ps(difference, difference));
+	}
+	float lanes[8];
+	_mm256_storeu_ps(lanes, sums);
+	for (int l = 0; l < 8; l++){
+		sum += lanes[l];
+	}
+	return i;
+}
+#endif
+
+/**
+ * Function squared_difference_int8 sums squared differences of int8 values (vector kernel if the CPU supports it)
+ */
+static long long squared_difference_int8(const schar * values, const schar * gt_values, int size)
+{
+	long long sum = 0;
+	int i = 0;
+#ifdef HOG_X86_KERNELS
+	if (__builtin_cpu_supports("avx2")){
+		i = squared_difference_int8_avx2(values, gt_values, size, sum);
+	}
+#endif
+	for (; i < size; i++){
+		int difference = values[i] - gt_values[i];
+		sum += difference*difference;
+	}
+	return sum;
+}
+
+/**
+ * Function squared_difference_fp16 sums squared differences of fp16 values widened to float (vector kernel
+ * if the CPU supports it)
+ */
+static double squared_difference_fp16(const ushort * values, const ushort * gt_values, int size)
+{
+	double sum = 0;
+	int i = 0;
+#ifdef HOG_X86_KERNELS
+	if (__builtin_cpu_supports("avx2")){
+		i = squared_difference_fp16_avx2(values, gt_values, size, sum);
+	}
+#endif
+	for (; i < size; i++){
+		float difference = half_to_float(values[i]) - half_to_float(gt_values[i]);
+		sum += difference*difference;
+	}
+	return sum;
+}
+
+/**
+ * Function squared_distance sums squared differences of quantized values (int8 ones scaled back by 1/127^2),
+ * so it approximates the squared L2 distance of the float values
+ *
+ * \values quantized values of the candidate (CV_8S or fp16 bits, as gt_quantized)
+ * \gt_values quantized values of the template at the same position
+ * \size amount of values
+ */
+double ReducedPrecisionL2::squared_distance(const uchar * values, const uchar * gt_values, int size) const
+{
+	if (precision == 1){
+		return (double)squared_difference_int8((const schar *)values, (const schar *)gt_values, size)/(INT8_SCALE*INT8_SCALE);
+	}
+	return squared_difference_fp16((const ushort *)values, (const ushort *)gt_values, size);
+}
+
+/**
+ * Function distance computes L2 distance of the descriptor to the template on quantized values: int8 differences
+ * are squared and summed by integer multiply-add, fp16 values are widened to float. Both precisions approximate
+ * norm(gt_hist, descriptor). The descriptor is quantized on every call (distance_of_blocks quantizes blocks once).
+ *
+ * \descriptor candidate descriptor (descriptor size x 1, CV_32F), of the template size
+ */
+double ReducedPrecisionL2::distance(const Mat &descriptor)
+{
+	quantize(descriptor, candidate_quantized);
+	CV_Assert(candidate_quantized.total() == gt_quantized.total());
+	return std::sqrt(squared_distance(candidate_quantized.data, gt_quantized.data, (int)candidate_quantized.total()));
+}
+
+/**
+ * Function reset_blocks forgets quantized blocks of the previous frame (done once per frame, the float blocks
+ * of the frame are kept by the block source)
+ *
+ * \key_region region, where blocks of the frame can start (region of the gradient field)
+ * \block_size values of one block
+ */
+void ReducedPrecisionL2::reset_blocks(Rect key_region, int block_size)
+{
+	block_values = block_size;
+	block_buffer.resize(block_size);
+	// float slots of the cache fit fp16 values (int8 ones take half of them)
+	quantized_blocks.reset(key_region, (block_size*2 + 3)/4);
+}
+
+/**
+ * Function distance_of_blocks computes L2 distance of the descriptor of the rectangle to the template block by block:
+ * every block of the frame is quantized at its first use and shared by all candidates containing it, so neither
+ * the float descriptor is assembled nor the candidate quantized. Blocks are the final descriptor values only if
+ * descriptors are not normalized (NORM_MINMAX of the whole descriptor).
+ *
+ * \block_source GradientField or IntegralOrientationHistogram of the frame (covers() has to be true)
+ * \rectangle candidate in frame coordinates
+ */
+template <class BlockSource> double ReducedPrecisionL2::distance_of_blocks(BlockSource &block_source, Rect rectangle)
+{
+	Size window = rectangle.size() / HOG_CELL * HOG_CELL;
+	int blocks_x = std::max((window.width - HOG_BLOCK)/HOG_CELL + 1, 0);
+	int blocks_y = std::max((window.height - HOG_BLOCK)/HOG_CELL + 1, 0);
+	CV_Assert((size_t)blocks_x*blocks_y*block_values == gt_quantized.total());
+	size_t block_bytes = block_values*gt_quantized.elemSize();
+
+	double sum = 0;
+	for (int bx = 0; bx < blocks_x; bx++){
+		for (int by = 0; by < blocks_y; by++){
+			int x = rectangle.x + bx*HOG_CELL, y = rectangle.y + by*HOG_CELL;
+			const uchar * block = (const uchar *)quantized_blocks.find(x, y);
+			if (block == 0){
+				// float block of the frame (shared with float descriptors, if the source caches blocks)
+				const float * hist = block_buffer.data();
+				if (block_source.caching){
+					hist = block_source.cached_block(x, y);
+				} else {
+					block_source.block_histogram(x, y, block_buffer.data());
+				}
+				float * slot = quantized_blocks.insert(x, y);
+				Mat quantized(block_values, 1, gt_quantized.type(), slot);
+				quantize(Mat(block_values, 1, CV_32F, (void *)hist), quantized);
+				block = (const uchar *)slot;
+			}
+			sum += squared_distance(block, gt_quantized.data + (bx*blocks_y + by)*block_bytes, block_values);
+		}
+	}
+	return std::sqrt(sum);
+}
+
+template double ReducedPrecisionL2::distance_of_blocks<GradientField>(GradientField &block_source, Rect rectangle);
+template double ReducedPrecisionL2::distance_of_blocks<IntegralOrientationHistogram>(IntegralOrientationHistogram &block_source, Rect rectangle);
+
+/**
+ * Function check_argmin compares the candidates chosen with reduced precision and float distances of one frame
+ *
+ * \reduced_scores distances of candidates computed by distance()
+ * \float_scores distances of the same candidates computed with norm() on float descriptors
+ */
+void ReducedPrecisionL2::check_argmin(const vector<double> &reduced_scores, const vector<double> &float_scores)
+{
+	if (reduced_scores.empty() || reduced_scores.size() != float_scores.size()){
+		return;
+	}
+	checked_frames++;
+	if (min_element(reduced_scores.begin(), reduced_scores.end()) - reduced_scores.begin() ==
+			min_element(float_scores.begin(), float_scores.end()) - float_scores.begin()){
+		agreeing_frames++;
+	}
+}
+
+/**
+ * Function agreement returns the share of checked frames, in which reduced precision did not change the prediction
+ */
+double ReducedPrecisionL2::agreement(void) const
+{
+	return checked_frames > 0 ? (double)agreeing_frames/checked_frames : 0;
+}
+
+// constructor
+BatchL2::BatchL2(void)
+{
+	capacity = 256;
+	gt_squared_norm = 0;
+	filled = 0;
+}
+
+/**
+ * Function set_template keeps the template descriptor (the column of the gemm, in double) and its squared norm
+ *
+ * \gt_hist template descriptor (descriptor size x 1, CV_32F)
+ */
+void BatchL2::set_template(const Mat &gt_hist)
+{
+	gt_hist.convertTo(gt_descriptor, CV_64F);
+	gt_squared_norm = gt_descriptor.dot(gt_descriptor);
+	candidates.create(capacity, (int)gt_descriptor.total(), CV_64F);
+	squared_norms.resize(capacity);
+}
+
+/**
+ * Function begin forgets scores of the previous frame
+ */
+void BatchL2::begin(void)
+{
+	scores.clear();
+	filled = 0;
+}
+
+/**
+ * Function add copies the descriptor to the next row of the chunk (widened to double) and sums its squared values
+ * in the same pass
+ *
+ * \descriptor candidate descriptor (descriptor size x 1, CV_32F, continuous), of the template size
+ */
+void BatchL2::add(const Mat &descriptor)
+{
+	CV_Assert(descriptor.total() == gt_descriptor.total() && descriptor.isContinuous());
+	const float * values = descriptor.ptr<float>();
+	double * row = candidates.ptr<double>(filled);
+	int size = candidates.cols;
+	double sum = 0;
+	for (int i = 0; i < size; i++){
+		row[i] = values[i];
+		sum += row[i]*row[i];
+	}
+	squared_norms[filled++] = sum;
+	if (filled == capacity){
+		flush();
+	}
+}
+
+/**
+ * Function flush computes products of the filled rows with the template (one gemm) and their distances.
+ * The expansion subtracts nearly equal terms for candidates close to the template, so norms and products
+ * are accumulated in double: the cancellation error stays far below the differences between candidates.
+ */
+void BatchL2::flush(void)
+{
+	if (filled == 0){
+		return;
+	}
+	gemm(candidates.rowRange(0, filled), gt_descriptor, 1, Mat(), 0, products);
+	for (int i = 0; i < filled; i++){
+		double squared_distance = squared_norms[i] - 2.*products.at<double>(i) + gt_squared_norm;
+		scores.push_back(std::sqrt(std::max(squared_distance, 0.)));
+	}
+	filled = 0;
+}
+
+/**
+ * Function finish scores the last chunk
+ *
+ * \return L2 distances of all candidates added since begin, in their order
+ */
+const vector<double> & BatchL2::finish(void)
+{
+	flush();
+	return scores;
+}
+
+// constructor
+BoundedL2::BoundedL2(void)
+{
+	chunk = 64;
+	candidates = 0;
+	abandoned = 0;
+	values = 0;
+	skipped_values = 0;
+}
+
+/**
+ * Function distance computes L2 distance like norm(gt_descriptor, descriptor), checking after every chunk of values
+ * if the partial sum of squared differences already exceeds best^2 (the distance cannot be lower than best then)
+ *
+ * \gt_descriptor template descriptor (CV_32F, continuous)
+ * \descriptor candidate descriptor of the template size (CV_32F, continuous)
+ * \best smallest distance of the candidates of the frame scored so far (DBL_MAX if none)
+ *
+ * \return distance, or DBL_MAX if the candidate was abandoned
+ */
+double BoundedL2::distance(const Mat &gt_descriptor, const Mat &descriptor, double best)
+{
+	CV_Assert(descriptor.total() == gt_descriptor.total() && descriptor.isContinuous() && gt_descriptor.isContinuous());
+	const float * gt_values = gt_descriptor.ptr<float>();
+	const float * candidate_values = descriptor.ptr<float>();
+	int size = (int)descriptor.total();
+	double bound = best < DBL_MAX ? best*best : DBL_MAX;
+	candidates++;
+	values += size;
+
+	double sum = 0;
+	for (int from = 0; from < size; from += chunk){
+		int to = std::min(from + chunk, size);
+		float partial = 0;
+		for (int i = from; i < to; i++){
+			float difference = candidate_values[i] - gt_values[i];
+			partial += difference*difference;
+		}
+		sum += partial;
+		if (sum > bound && to < size){
+			abandoned++;
+			skipped_values += size - to;
+			return DBL_MAX;
+		}
+	}
+	return std::sqrt(sum);
+}
+
+// constructor
+ProjectedL2::ProjectedL2(void)
+{
+	components = 0;
+	block_values = 0;
+}
+
+/**
+ * Function learn computes principal components of blocks of descriptors of the tracked object (samples of the first
+ * frame, every block of every sample is one observation) and keeps the first dimensions of them
+ *
+ * \samples descriptors of the ground truth box and its neighbourhood, one per row (CV_32F)
+ * \dimensions amount of kept components (at most the block size)
+ * \block_size values of one block
+ * \gt_hist template descriptor (descriptor size x 1, CV_32F)
+ */
+void ProjectedL2::learn(const Mat &samples, int dimensions, int block_size, const Mat &gt_hist)
+{
+	Mat blocks = samples.reshape(1, (int)(samples.total()/block_size));
+	PCA pca(blocks, Mat(), PCA::DATA_AS_ROW, std::min(dimensions, block_size));
+	pca.eigenvectors.convertTo(basis, CV_32F);
+	components = basis.rows;
+	block_values = block_size;
+	block_buffer.resize(block_size);
+	gemm(gt_hist.reshape(1, (int)(gt_hist.total()/block_size)), basis, 1, Mat(), 0, gt_projected, GEMM_2_T);
+	projected_blocks.reset(projected_blocks.region, components);
+}
+
+/**
+ * Function reset_blocks forgets projected blocks of the previous frame (done once per frame)
+ *
+ * \key_region region, where blocks of the frame can start (region of the gradient field)
+ */
+void ProjectedL2::reset_blocks(Rect key_region)
+{
+	projected_blocks.reset(key_region, components);
+}
+
+/**
+ * Function project multiplies the block by the basis
+ *
+ * \block block_values values
+ * \out components values of the projected block
+ */
+void ProjectedL2::project(const float * block, float * out) const
+{
+	for (int k = 0; k < components; k++){
+		const float * component = basis.ptr<float>(k);
+		float sum = 0;
+		for (int b = 0; b < block_values; b++){
+			sum += component[b]*block[b];
+		}
+		out[k] = sum;
+	}
+}
+
+/**
+ * Function distance_of_blocks computes L2 distance of the descriptor of the rectangle to the template in the subspace
+ * of blocks: every block of the frame is projected at its first use and shared by all candidates containing it,
+ * so the float descriptor is never assembled. Blocks are the final descriptor values only if descriptors
+ * are not normalized (NORM_MINMAX of the whole descriptor).
+ *
+ * \block_source GradientField or IntegralOrientationHistogram of the frame (covers() has to be true)
+ * \rectangle candidate in frame coordinates
+ */
+template <class BlockSource> double ProjectedL2::distance_of_blocks(BlockSource &block_source, Rect rectangle)
+{
+	Size window = rectangle.size() / HOG_CELL * HOG_CELL;
+	int blocks_x = std::max((window.width - HOG_BLOCK)/HOG_CELL + 1, 0);
+	int blocks_y = std::max((window.height - HOG_BLOCK)/HOG_CELL + 1, 0);
+	CV_Assert(blocks_x*blocks_y == gt_projected.rows);
+
+	double sum = 0;
+	for (int bx = 0; bx < blocks_x; bx++){
+		for (int by = 0; by < blocks_y; by++){
+			int x = rectangle.x + bx*HOG_CELL, y = rectangle.y + by*HOG_CELL;
+			const float * values = projected_blocks.find(x, y);
+			if (values == 0){
+				// float block of the frame (shared with float descriptors, if the source caches blocks)
+				const float * hist = block_buffer.data();
+				if (block_source.caching){
+					hist = block_source.cached_block(x, y);
+				} else {
+					block_source.block_histogram(x, y, block_buffer.data());
+				}
+				float * slot = projected_blocks.insert(x, y);
+				project(hist, slot);
+				values = slot;
+			}
+			const float * gt_values = gt_projected.ptr<float>(bx*blocks_y + by);
+			for (int k = 0; k < components; k++){
+				float difference = values[k] - gt_values[k];
+				sum += difference*difference;
+			}
+		}
+	}
+	return std::sqrt(sum);
+}
+
+template double ProjectedL2::distance_of_blocks<GradientField>(GradientField &block_source, Rect rectangle);
+template double ProjectedL2::distance_of_blocks<IntegralOrientationHistogram>(IntegralOrientationHistogram &block_source, Rect rectangle);
+
+/**
+ * Function distance projects all blocks of the descriptor (one gemm with the basis) and computes their distance
+ * to the projected template blocks
+ *
+ * \descriptor candidate descriptor (descriptor size x 1, CV_32F, continuous), of the template size
+ */
+double ProjectedL2::distance(const Mat &descriptor)
+{
+	CV_Assert(descriptor.total() == (size_t)gt_projected.rows*block_values && descriptor.isContinuous());
+	gemm(descriptor.reshape(1, gt_projected.rows), basis, 1, Mat(), 0, projected, GEMM_2_T);
+	return norm(projected, gt_projected);
+}
+
+// constructor
+DenseCellMatcher::DenseCellMatcher(void)
+{
+	bins_param = 0;
+	gt_energy = 0;
+}
+
+/**
+ * Function compute_cell_maps splits magnitudes of the gradient field into bins planes and sums every plane over
+ * 8 x 8 cells starting at every pixel (cell_maps[b](y, x) is the bin b of the cell with top left corner (x, y))
+ */
+void DenseCellMatcher::compute_cell_maps(const GradientField &gradient_field)
+{
+	Size size = gradient_field.region.size();
+	cell_maps.resize(bins_param);
+	for (int b = 0; b < bins_param; b++){
+		cell_maps[b].create(size, CV_32F);
+		cell_maps[b] = Scalar(0);
+	}
+	for (int i = 0; i < size.height; i++){
+		const float * magnitudes = gradient_field.grad.ptr<float>(i);
+		const uchar * bins = gradient_field.qangle.ptr<uchar>(i);
+		for (int j = 0; j < size.width; j++){
+			cell_maps[bins[j*2]].ptr<float>(i)[j] += magnitudes[j*2];
+			cell_maps[bins[j*2 + 1]].ptr<float>(i)[j] += magnitudes[j*2 + 1];
+		}
+	}
+	for (int b = 0; b < bins_param; b++){
+		boxFilter(cell_maps[b], cell_maps[b], CV_32F, Size(HOG_CELL, HOG_CELL), Point(0, 0), false, BORDER_CONSTANT);
+	}
+}
+
+/**
+ * Function set_template takes cells of the box (rounded down to multiple of 8) from the first frame and prepares
+ * their spectra
+ *
+ * \gradient_field gradients of the first frame (covering the box)
+ * \box ground truth rectangle
+ * \max_region size of the largest gradient field region expected (the region may grow later, see plan)
+ */
+void DenseCellMatcher::set_template(const GradientField &gradient_field, Rect box, Size max_region)
+{
+	bins_param = gradient_field.bins_param;
+	cells = Size(box.width / HOG_CELL, box.height / HOG_CELL);
+	compute_cell_maps(gradient_field);
+
+	Point origin = box.tl() - gradient_field.region.tl();
+	gt_cells.create(bins_param, cells.area(), CV_32F);
+	for (int b = 0; b < bins_param; b++){
+		float * values = gt_cells.ptr<float>(b);
+		for (int cy = 0; cy < cells.height; cy++){
+			for (int cx = 0; cx < cells.width; cx++){
+				values[cy*cells.width + cx] = cell_maps[b].at<float>(origin.y + cy*HOG_CELL, origin.x + cx*HOG_CELL);
+			}
+		}
+	}
+	gt_energy = gt_cells.dot(gt_cells);
+	plan(max_region);
+}
+
+/**
+ * Function plan sizes the DFT for the region, places template cells on the 8 pixels lattice of zero padded kernels
+ * and transforms the kernels (done once per track, and again only if the search region grows beyond the DFT size)
+ *
+ * \max_region size of the largest gradient field region to be matched
+ */
+void DenseCellMatcher::plan(Size max_region)
+{
+	dft_size = Size(getOptimalDFTSize(max_region.width), getOptimalDFTSize(max_region.height));
+	Mat kernel(dft_size, CV_32F);
+	Mat ones = Mat::zeros(dft_size, CV_32F);
+	kernel_spectra.resize(bins_param);
+	for (int b = 0; b < bins_param; b++){
+		kernel = Scalar(0);
+		const float * values = gt_cells.ptr<float>(b);
+		for (int cy = 0; cy < cells.height; cy++){
+			for (int cx = 0; cx < cells.width; cx++){
+				kernel.at<float>(cy*HOG_CELL, cx*HOG_CELL) = values[cy*cells.width + cx];
+				ones.at<float>(cy*HOG_CELL, cx*HOG_CELL) = 1;
+			}
+		}
+		dft(kernel, kernel_spectra[b]);
+	}
+	dft(ones, ones_spectrum);
+}
+
+/**
+ * Function pays_off estimates, if one dense matching of the region costs less than scoring the candidates
+ * by descriptors: the matching takes bins + 2 real DFTs of the padded region (A log2 A operations each) plus bins
+ * passes over the region, scoring takes about two passes (assembling and distance) over every candidate descriptor.
+ * Sparse grids (large stride, few candidates) are thus scored by descriptors, dense ones by the correlation surface.
+ *
+ * \region size of the search region of the frame
+ * \candidates_amount amount of candidates, which would be scored
+ * \descriptor_size values of the HOG descriptor of the box
+ */
+bool DenseCellMatcher::pays_off(Size region, int candidates_amount, int descriptor_size) const
+{
+	if (kernel_spectra.empty()){
+		return false;
+	}
+	double area = (double)getOptimalDFTSize(region.width)*getOptimalDFTSize(region.height);
+	double matching_cost = (bins_param + 2)*area*std::log2(std::max(area, 2.)) + bins_param*region.area();
+	double scoring_cost = 2.*candidates_amount*descriptor_size;
+	return matching_cost < scoring_cost;
+}
+
+/**
+ * Function match computes squared distances of all windows of the gradient field region: bins planes and the energy
+ * plane are zero padded, transformed, multiplied by conjugated kernel spectra (correlation) and accumulated,
+ * then the sum is transformed back once
+ */
+void DenseCellMatcher::match(const GradientField &gradient_field)
+{
+	Size size = gradient_field.region.size();
+	matched = Rect(gradient_field.region.tl(), Size(size.width - cells.width*HOG_CELL + 1, size.height - cells.height*HOG_CELL + 1));
+	if (kernel_spectra.empty() || matched.width <= 0 || matched.height <= 0){
+		matched = Rect();
+		return;
+	}
+	// the region grew beyond the planned DFT (e.g. the grid of kalman_search widened)
+	if (size.width > dft_size.width || size.height > dft_size.height){
+		plan(Size(std::max(size.width, dft_size.width), std::max(size.height, dft_size.height)));
+	}
+	compute_cell_maps(gradient_field);
+
+	plane.create(dft_size, CV_32F);
+	accumulated.create(dft_size, CV_32F);
+	accumulated = Scalar(0);
+	Mat energy = Mat::zeros(size, CV_32F);
+	for (int b = 0; b <= bins_param; b++){
+		plane = Scalar(0);
+		if (b < bins_param){
+			// cross term of the bin
+			cell_maps[b].copyTo(plane(Rect(Point(0, 0), size)));
+			accumulateSquare(cell_maps[b], energy);
+		} else {
+			// energy term
+			energy.copyTo(plane(Rect(Point(0, 0), size)));
+		}
+		dft(plane, spectrum, 0, size.height);
+		mulSpectrums(spectrum, b < bins_param ? kernel_spectra[b] : ones_spectrum, product, 0, true);
+		scaleAdd(product, b < bins_param ? -2. : 1., accumulated, accumulated);
+	}
+	dft(accumulated, surface, DFT_INVERSE + DFT_SCALE + DFT_REAL_OUTPUT);
+}
+
+/**
+ * Function distance returns L2 distance of cells of the window to the template cells (cell features, not the HOG L2
+ * distance of descriptors)
+ */
+double DenseCellMatcher::distance(int x, int y) const
+{
+	if (!matched.contains(Point(x, y))){
+		return DBL_MAX;
+	}
+	double squared_distance = surface.at<float>(y - matched.y, x - matched.x) + gt_energy;
+	return std::sqrt(std::max(squared_distance, 0.));
+}
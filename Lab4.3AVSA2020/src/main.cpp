@@ -49,12 +49,73 @@ using namespace tracker;
 //ACCORDING TO ALGORITHM IT SHOULD BE ALWAYS FALSE - DONT CHANGE IT!
 #define NORMALIZATION_GRAD false
 
+//HOG_MODE is the way candidates HOG descriptors are computed
+//				 0 - hog.compute for every candidate (reference)
+//				 1 - assembled from gradients computed once per frame over the search region
+//				 2 - assembled from cells of integral orientation histograms built once per frame
+#define HOG_MODE 0
+
+//FAST_GRADIENTS tells, if gradients of HOG_MODE 1 and 2 are computed by the vectorised kernel (int16 derivatives,
+//orientation bins without atan2, approximated magnitudes, no gamma correction) instead of HOGDescriptor::computeGradient
+#define FAST_GRADIENTS false
+
+//PCA_COMPONENTS is the amount of principal components of HOG blocks (learned from the first frame, at most 4 x BINS_NUMBER),
+//in which candidates are scored (0 - full descriptors; used instead of HOG_PRECISION, HOG_BATCH and EARLY_TERMINATION).
+//Only with HOG_MODE 1 or 2 and NORMALIZATION_GRAD false (blocks projected once per frame), otherwise it is ignored
+//and candidates are scored by float descriptors, since projecting every descriptor is slower
+#define PCA_COMPONENTS 0
+
+//DENSE_MATCHING tells, if candidates may be scored by distances of their 8 x 8 cells histograms to the template cells,
+//computed for all windows of the search region at once by FFT correlation; the tracker decides it once per track, only if
+//the full grid (CANDIDATE_GRID_SIDE, GRID_PIXEL_STRIDE) is dense enough (e.g. GRID_PIXEL_STRIDE 1) for it to be cheaper than
+//descriptors, and then scores every frame this way. The score is the distance of raw cell features, not the HOG L2 distance
+#define DENSE_MATCHING false
+
+//HOG_PRECISION is the precision of descriptors in L2 scoring
+//				 0 - float
+//				 1 - int8
+//				 2 - fp16
+//Reduced precision is used only with HOG_MODE 1 or 2 and NORMALIZATION_GRAD false (blocks quantized once per frame), otherwise
+//it is ignored and candidates are scored by float descriptors, since quantizing every descriptor is slower
+#define HOG_PRECISION 0
+//PRECISION_CHECK tells, if float distances are computed too, to report how often the reduced precision chose the same candidate
+#define PRECISION_CHECK false
+
+//HOG_BATCH tells, if L2 distances of all candidates are computed at once (stacked descriptors, norm expansion and gemm)
+#define HOG_BATCH false
+
+//EARLY_TERMINATION tells, if candidates are scored nearest the last prediction first and abandoned as soon as
+//their partial L2 distance exceeds the best one so far (HOG_PRECISION 0, HOG_BATCH false)
+#define EARLY_TERMINATION false
+
+//HOG_CACHE tells, if blocks (and cells) of HOG descriptors are computed once per frame and shared by candidates
+//(HOG_MODE 1 and 2; with GRID_PIXEL_STRIDE not dividing 8 the candidates origins are snapped to shared cells)
+#define HOG_CACHE false
+
+//PYRAMID_LEVELS is the amount of image pyramid levels of the coarse-to-fine search (0 - the whole candidates grid
+//is scored); candidates are scored on the downsampled search region first and only the neighbourhoods
+//of the PYRAMID_TOP_K best of them are scored on the full resolution grid
+#define PYRAMID_LEVELS 0
+#define PYRAMID_TOP_K 3
+
+//SEARCH_STRATEGY is the way candidates are searched (PYRAMID_LEVELS 0), block-matching patterns probe around
+//the best candidate so far and contract, instead of scoring the whole grid
+//				 0 - the whole candidates grid
+//				 1 - three-step search
+//				 2 - diamond search
+//				 3 - hexagon-based search
+#define SEARCH_STRATEGY 0
+
+//KALMAN_SEARCH tells, if the search is centred on the position predicted by a constant-velocity Kalman filter and
+//the candidates grid is sized from its innovation covariance (CANDIDATE_GRID_SIDE is then the largest side)
+#define KALMAN_SEARCH false
+
 //main function
 int main(int argc, char ** argv)
 {
 	cout<< "Lab4_3_gradient_tracker" << endl <<
 			" Params: chan" << CHANNEL_TYPE << " cands " << CANDIDATE_GRID_SIDE << " stride " << GRID_PIXEL_STRIDE << " bins " << BINS_NUMBER  <<
-			" normal " << NORMALIZATION_GRAD << endl;;
+			" normal " << NORMALIZATION_GRAD << " hog_mode " << HOG_MODE << " hog_cache " << HOG_CACHE << " fast_grad " << FAST_GRADIENTS << " hog_precision " << HOG_PRECISION << " hog_batch " << HOG_BATCH << " early_term " << EARLY_TERMINATION << " pca " << PCA_COMPONENTS << " dense " << DENSE_MATCHING << " pyramid " << PYRAMID_LEVELS << " top_k " << PYRAMID_TOP_K << " search " << SEARCH_STRATEGY << " kalman " << KALMAN_SEARCH << endl;;
 	//PLEASE CHANGE 'dataset_path' & 'output_path' ACCORDING TO YOUR PROJECT
 	std::string dataset_path = "/home/janek/avsa/AVSA2020datasets/AVSA_lab4_datasets/datasets/";
 	std::string output_path = "/home/janek/avsa/AVSA2020results/outvideos/";	//location to save output videos
@@ -128,7 +189,15 @@ int main(int argc, char ** argv)
 		int hist_w = 250, hist_h = 250;
 		int bin_w = cvRound( (double) hist_w/BINS_NUMBER );
 		// initialization of tracking class,
-		GradientBasedTracker tracker(frame,list_bbox_gt[0],BINS_NUMBER,CANDIDATE_GRID_SIDE,GRID_PIXEL_STRIDE,CHANNEL_TYPE, NORMALIZATION_GRAD);
+		GradientBasedTracker tracker(frame,list_bbox_gt[0],BINS_NUMBER,CANDIDATE_GRID_SIDE,GRID_PIXEL_STRIDE,CHANNEL_TYPE, NORMALIZATION_GRAD, HOG_MODE, FAST_GRADIENTS, PCA_COMPONENTS, DENSE_MATCHING);
+		tracker.hog_cache = HOG_CACHE;
+		tracker.hog_precision = HOG_PRECISION;
+		tracker.precision_check = PRECISION_CHECK;
+		tracker.hog_batch = HOG_BATCH;
+		tracker.early_termination = EARLY_TERMINATION;
+		tracker.search_strategy = SEARCH_STRATEGY;
+		tracker.kalman_search = KALMAN_SEARCH;
+		tracker.configure_pyramid(PYRAMID_LEVELS, PYRAMID_TOP_K);
 		for (;;) {
 			//get frame & check if we achieved the end of the videofile (e.g. frame.data is empty)
 
@@ -146,15 +215,11 @@ int main(int argc, char ** argv)
 			//DO TRACKING
 			//Change the following line with your own code
 
-			//Conducting the tracking step for video's frame - not in usage because we want to get list_candidates for experiment visualisation
-			//list_bbox_est.push_back(tracker.execute_tracking_step(frame));
-
-			//extracts channel of interest from the frame
-			tracker.convert_RGB_to_channel(frame);
-			//generates candidates
-			list_candidates = tracker.generate_candidates();
-			//scores candidates and return the best one
-			list_bbox_est.push_back(tracker.find_best_candidate(list_candidates));
+			//Conducting the tracking step for video's frame (undrawn copy made before the time measurement: the tracker
+			//converts pixels out of its search region from it later, e.g. for the ground truth histogram)
+			list_bbox_est.push_back(tracker.execute_tracking_step(frame_for_crop));
+			//candidates of the step, for experiment visualisation
+			list_candidates = tracker.step_candidates;
 
 			////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -216,6 +281,20 @@ int main(int argc, char ** argv)
 		//print stats about processing time and tracking performance
 		std::cout << "  Average processing time = " << std::accumulate( procTimes.begin(), procTimes.end(), 0.0) / procTimes.size() << " ms/frame" << std::endl;
 		std::cout << "  Average tracking performance = " << std::accumulate( trackPerf.begin(), trackPerf.end(), 0.0) / trackPerf.size() << std::endl;
+		if (PYRAMID_LEVELS > 0)
+			std::cout << "  Pyramid search: candidates scored per frame = " << tracker.pyramid.evaluations_per_frame()
+					<< " (" << tracker.pyramid.coarse_evaluations << " coarse, " << tracker.pyramid.fine_evaluations << " full resolution)" << std::endl;
+		else if (SEARCH_STRATEGY != 0)
+			std::cout << "  Pattern search: candidates evaluated per frame = " << tracker.pattern.evaluations_per_frame() << std::endl;
+		if (KALMAN_SEARCH)
+			std::cout << "  Kalman search: average grid side = " << tracker.motion.average_grid_side() << " (of " << CANDIDATE_GRID_SIDE << ")" << std::endl;
+		if (EARLY_TERMINATION)
+			std::cout << "  Early termination: abandoned candidates = " << tracker.bounded_l2.abandoned << " of " << tracker.bounded_l2.candidates
+					<< ", skipped values = " << tracker.bounded_l2.skipped_values << " of " << tracker.bounded_l2.values << std::endl;
+		if (HOG_CACHE && HOG_MODE != 0)
+			std::cout << "  HOG block cache hit rate = " << tracker.hog_cache_hit_rate() << std::endl;
+		if (PRECISION_CHECK && HOG_PRECISION != 0)
+			std::cout << "  HOG reduced precision argmin agreement = " << tracker.reduced_l2.agreement() << std::endl;
 
 		//release all resources
 		cap.release();			// close inputvideo
@@ -12,6 +12,9 @@
 #ifndef GradientBasedTracker_HPP_INCLUDE
 #define GradientBasedTracker_HPP_INCLUDE
 
+#include "HOGEngine.hpp"
+#include "SearchEngine.hpp"
+
 using namespace cv;
 using namespace std;
 
@@ -22,7 +25,7 @@ namespace tracker {
 	//Public functions
 	public:
 		//constructor function
-		GradientBasedTracker(Mat frame, Rect ground_truth, int bins, int cand, int pix_stride, int channel_id, bool normal);
+		GradientBasedTracker(Mat frame, Rect ground_truth, int bins, int cand, int pix_stride, int channel_id, bool normal, int hog_computation_mode, bool fast_gradients, int pca_dimensions, bool dense);
 
 		//destructor function
 		~GradientBasedTracker(void);
@@ -30,28 +33,83 @@ namespace tracker {
 		//generating candidates
 		vector<Rect>  generate_candidates(void);
 
+		//removes candidates lying (partly) out of the frame
+		void discard_out_of_frame(vector<Rect> &candidates);
+
+		//top left corners of candidates lying inside the frame
+		Rect candidate_origins(Size frame_size);
+
+		//moves origins of candidates to the lattice of cells shared by the HOG cache (hog_cache)
+		void snap_to_cells(vector<Rect> &candidates);
+
+		//sets up coarse-to-fine search (has to be called before tracking, the coarse template is taken from the first frame)
+		void configure_pyramid(int levels, int top_k);
+
+		//generating candidates by coarse-to-fine search (pyramid.levels > 0)
+		vector<Rect>  pyramid_candidates(void);
+
+		//generating candidates by block-matching pattern search (search_strategy 1, 2 and 3)
+		vector<Rect>  pattern_candidates(void);
+
 		//scoring and choosing best candidate
 		Rect find_best_candidate(vector<Rect> candidates);
 
+		//scoring candidates, returns index of the best one (last prediction is not moved)
+		int best_candidate_index(const vector<Rect> &candidates, Point anchor);
+
+		//tells if frames are scored by dense matching (dense_matching with the whole grid searched, fixed for the track)
+		bool dense_scoring(void) const;
+
 		//executes step for every frame
 		Rect execute_tracking_step(Mat frame);
 
+		//moves last prediction to the position predicted by the Kalman filter and sizes the grid (kalman_search)
+		void predict_search_window(Size frame_size);
+
 		// extracrs channel of interest from frame
 		void convert_RGB_to_channel(Mat frame);
 
 		//calculate histogram for the candidate
 		Mat calculate_HOG(Rect rectangle);
 
+		//calculate histogram for the candidate into the extractor buffer (no copy)
+		const Mat & compute_HOG(Rect rectangle);
+
+		//L2 distance of the candidate to the template in reduced precision (hog_precision 1 and 2)
+		double reduced_HOG_distance(Rect rectangle);
+
+		//L2 distance of the candidate to the template in the PCA subspace of blocks (pca_dimensions)
+		double projected_HOG_distance(Rect rectangle);
+
+		//share of candidates blocks found in the cache (hog_cache)
+		double hog_cache_hit_rate(void);
+
+		//order of scoring candidates (nearest the anchor first, if nearest_first)
+		vector<int> scoring_order(const vector<Rect> &candidates, bool nearest_first, Point anchor);
+
+		//bounding box of the candidates grid around last prediction
+		Rect compute_search_region(Size frame_size);
+
+		//converts the part of the rectangle lying out of the search region
+		void convert_outside_region(Rect rectangle);
+
 		// ground truth histogram of the tracked object (taken from first frame)
 		Mat gt_hist;
-		// actual frame (with already extracted channel of interest)
+		// actual frame (with already extracted channel of interest, valid only inside the search region)
 		Mat actual_frame;
+		// part of the frame read by the tracker (bounding box of all candidates and their gradient borders),
+		// only this part is converted
+		Rect search_region;
+		// frame passed to convert_RGB_to_channel, not copied (pixels out of the search region are converted from it on demand)
+		Mat current_frame;
 		// algortihm's prediction of object's position established in the previous frame
 		Rect last_prediction;
 		// [cand_param x cand_param] is amount of candidates generated in every frame
 		// (cand_param is side of the grid used to candidates generation,
 		// thus the total candidate amount is cand_param x cand_param)
 		int cand_param;
+		// largest side of the grid (cand_param given to the constructor, kalman_search only shrinks the grid)
+		int cand_param_max;
 		// the pixel distance between candidates rectangles generated in grid
 		int p_stride;
 		//the id of channel of interest for tracker
@@ -68,6 +126,72 @@ namespace tracker {
 		//normalization tells, if histograms should be normalized
 		bool normalization;
 
+		//the way candidates HOG descriptors are computed
+		// 0 - hog.compute for every candidate (reference)
+		// 1 - assembled from gradients computed once per frame over the search region
+		// 2 - assembled from cells of integral orientation histograms built once per frame
+		int hog_mode;
+		//tells if blocks (and cells in hog_mode 2) are cached per frame and shared by candidates (hog_mode 1 and 2)
+		bool hog_cache;
+		//precision of descriptors in L2 scoring
+		// 0 - float (norm)
+		// 1 - int8
+		// 2 - fp16
+		int hog_precision;
+		//tells if float distances are computed too, to check that the reduced precision chose the same candidate
+		bool precision_check;
+		// quantized template, blocks of the frame and candidate, argmin agreement counters (used if hog_precision is not 0)
+		ReducedPrecisionL2 reduced_l2;
+		//tells if L2 distances of all candidates are computed at once by norm expansion and gemm (hog_precision 0)
+		bool hog_batch;
+		// stacked candidates descriptors and the template (used with hog_batch)
+		BatchL2 batch_l2;
+		//tells if candidates are scored nearest last prediction first and abandoned as soon as their partial distance
+		//exceeds the best one so far (float precision, not batched)
+		bool early_termination;
+		// L2 distance with early termination and its skip counters (used with early_termination)
+		BoundedL2 bounded_l2;
+		// PCA subspace of blocks learned from the first frame, candidates are scored in it if it was learned
+		ProjectedL2 hog_pca;
+		//tells if candidates may be scored by distances of their cells to the template cells, computed for all windows
+		//of the search region at once by FFT correlation (decided once per track, true only if its largest grid is dense enough)
+		bool dense_matching;
+		// template cells spectra and the distance surface of the actual frame (used with dense_matching)
+		DenseCellMatcher dense_matcher;
+
+		//the way candidates are searched (without the pyramid search)
+		// 0 - the whole candidates grid
+		// 1 - three-step search
+		// 2 - diamond search
+		// 3 - hexagon-based search
+		int search_strategy;
+		// pattern geometry and its evaluation counters (used in search_strategy 1, 2 and 3)
+		PatternSearch pattern;
+		//tells if the search is centred on the position predicted by a constant-velocity Kalman filter
+		//and the candidates grid is sized from its innovation covariance
+		bool kalman_search;
+		// Kalman filter of the box position and the grid sides statistics (used with kalman_search)
+		MotionPredictor motion;
+		// candidates of the last execute_tracking_step (kept for visualisation)
+		vector<Rect> step_candidates;
+		// coarse-to-fine search geometry and its evaluation counters (used if pyramid.levels > 0)
+		PyramidSearch pyramid;
+		// search region of the actual frame downsampled by the pyramid (valid only with pyramid.levels > 0)
+		Mat coarse_frame;
+		// ground truth histogram of the tracked object on the coarse level (taken from first frame)
+		Mat coarse_gt_hist;
+		// HOG descriptor configured for the coarse box
+		HOGExtractor coarse_extractor;
+
+		// HOG descriptor and its buffers, configured once per track and reused by all candidates
+		HOGExtractor hog_extractor;
+		// gradients of the search region of the actual frame (used in hog_mode 1 and 2)
+		GradientField gradient_field;
+		// integral orientation histograms of the search region (used in hog_mode 2)
+		IntegralOrientationHistogram integral_orientation;
+		// scratch gradients and integral histograms of rectangles out of the search region (used in hog_mode 2)
+		GradientField outside_field;
+		IntegralOrientationHistogram outside_orientation;
 
 	};
 }
@@ -0,0 +1,408 @@
+/* Applied Video Sequence Analysis (AVSA)
+ *
+ *	LAB4: SearchEngine
+ *	SearchEngine.cpp
+ *
+ * 	Authors: Sergio Romero & Jan Sieradzki
+ *	IPCV & I2ICSI - 2021
+ */
+
+#include "SearchEngine.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <numeric>
+#include <set>
+
+using namespace cv;
+using namespace std;
+using namespace tracker;
+
+// constructor
+PyramidSearch::PyramidSearch(void)
+{
+	levels = 0;
+	top_k = 1;
+	scale = 1;
+	frames = 0;
+	coarse_evaluations = 0;
+	fine_evaluations = 0;
+}
+
+/**
+ * Function configure sets the amount of pyramid levels and of the coarse winners refined on the full resolution.
+ * Every level halves the box, levels are reduced until the coarse box keeps at least min_box_side pixels per side
+ * (e.g. one HOG block), otherwise coarse scores say nothing about the object.
+ *
+ * \pyramid_levels requested amount of pyramid levels (0 - no coarse level)
+ * \k amount of best coarse candidates refined on the full resolution
+ * \box_size size of the candidates rectangles (fixed per track)
+ * \min_box_side smallest side of the box on the coarse level
+ */
+void PyramidSearch::configure(int pyramid_levels, int k, Size box_size, int min_box_side)
+{
+	levels = std::max(pyramid_levels, 0);
+	while (levels > 0 && std::min(box_size.width, box_size.height) >> levels < min_box_side){
+		levels--;
+	}
+	top_k = std::max(k, 1);
+	scale = 1 << levels;
+}
+
+/**
+ * Function downsample builds the coarse level of the region of the plane with levels pyrDown steps (gaussian
+ * smoothing before every decimation, so the coarse level is not aliased)
+ *
+ * \plane image of the frame (valid inside the search region)
+ * \search_region part of the frame, which is downsampled (bounding box of the candidates)
+ * \coarse coarse level, region.size()/scale
+ */
+void PyramidSearch::downsample(const Mat &plane, Rect search_region, Mat &coarse)
+{
+	region = search_region;
+	Mat level = plane(region);
+	for (int l = 0; l < levels; l++){
+		pyrDown(level, coarse);
+		level = coarse;
+	}
+	if (levels == 0){
+		level.copyTo(coarse);
+	}
+}
+
+/**
+ * Function coarse_rect maps the rectangle of the frame to the coarse level of the last downsampled region
+ * (pixel i of the coarse level is centred on pixel i*scale of the region)
+ *
+ * \rectangle rectangle in frame coordinates
+ *
+ * \return rectangle in coarse level coordinates
+ */
+Rect PyramidSearch::coarse_rect(Rect rectangle) const
+{
+	return Rect(cvRound((double)(rectangle.x - region.x)/scale), cvRound((double)(rectangle.y - region.y)/scale),
+			rectangle.width/scale, rectangle.height/scale);
+}
+
+/**
+ * Function fits tells if the coarse rectangle lies inside the coarse level (candidates of the region border may
+ * fall out of it by rounding, they are not scored on the coarse level then)
+ *
+ * \rectangle rectangle in coarse level coordinates
+ * \coarse_size size of the coarse level
+ */
+bool PyramidSearch::fits(Rect rectangle, Size coarse_size) const
+{
+	return rectangle.area() > 0 && (rectangle & Rect(Point(0, 0), coarse_size)) == rectangle;
+}
+
+/**
+ * Function coarse_step returns the distance between coarse candidates: one coarse pixel (scale), rounded up to
+ * the multiple of the grid stride, so coarse candidates lie on the full resolution grid
+ *
+ * \stride pixel distance between candidates of the full resolution grid
+ */
+int PyramidSearch::coarse_step(int stride) const
+{
+	return stride*std::max((scale + stride - 1)/stride, 1);
+}
+
+/**
+ * Function coarse_grid generates coarse candidates (in frame coordinates) on the grid of coarse_step around
+ * the prediction, covering the same capture range as the full resolution grid
+ *
+ * \prediction rectangle predicted in the previous frame
+ * \reach largest shift of candidates from the prediction
+ * \stride pixel distance between candidates of the full resolution grid
+ */
+vector<Rect> PyramidSearch::coarse_grid(Rect prediction, int reach, int stride) const
+{
+	vector<Rect> candidates;
+	int step = coarse_step(stride);
+	int side = reach/step;
+	for (int j = -side; j <= side; j++){
+		for (int i = -side; i <= side; i++){
+			candidates.push_back(Rect(prediction.x + i*step, prediction.y + j*step, prediction.width, prediction.height));
+		}
+	}
+	return candidates;
+}
+
+/**
+ * Function refine selects the k coarse candidates with the smallest distances and returns the full resolution
+ * candidates around them: lattice points up to half of coarse_step away from every winner, so the neighbourhoods
+ * of adjacent coarse candidates cover the whole grid between them. The prediction itself is always included.
+ * Candidates are unique and sorted row by row (like the sliding window scan expects them).
+ *
+ * \coarse_candidates coarse candidates in frame coordinates
+ * \scores distances of coarse candidates (DBL_MAX if not scored)
+ * \prediction rectangle predicted in the previous frame
+ * \reach largest shift of candidates from the prediction
+ * \stride pixel distance between candidates of the full resolution grid
+ */
+vector<Rect> PyramidSearch::refine(const vector<Rect> &coarse_candidates, const vector<double> &scores, Rect prediction,
+		int reach, int stride)
+{
+	vector<int> order(scores.size());
+	iota(order.begin(), order.end(), 0);
+	int winners = std::min((int)order.size(), top_k);
+	partial_sort(order.begin(), order.begin() + winners, order.end(), [&scores](int a, int b){
+		return scores[a] < scores[b];
+	});
+
+	int half = coarse_step(stride)/2/stride;
+	// origins (y, x), ordered by rows
+	set<pair<int, int> > origins;
+	origins.insert(make_pair(prediction.y, prediction.x));
+	for (int w = 0; w < winners && scores[order[w]] != DBL_MAX; w++){
+		Point centre = coarse_candidates[order[w]].tl();
+		for (int dy = -half; dy <= half; dy++){
+			for (int dx = -half; dx <= half; dx++){
+				int x = centre.x + dx*stride, y = centre.y + dy*stride;
+				if (abs(x - prediction.x) <= reach && abs(y - prediction.y) <= reach){
+					origins.insert(make_pair(y, x));
+				}
+			}
+		}
+	}
+
+	vector<Rect> candidates;
+	candidates.reserve(origins.size());
+	for (auto it = origins.begin(); it != origins.end(); ++it){
+		candidates.push_back(Rect(it->second, it->first, prediction.width, prediction.height));
+	}
+	frames++;
+	coarse_evaluations += scores.size();
+	fine_evaluations += candidates.size();
+	return candidates;
+}
+
+/**
+ * Function evaluations_per_frame returns the average amount of candidates scored per frame on both levels
+ * (to compare with cand_param x cand_param of the full grid)
+ */
+double PyramidSearch::evaluations_per_frame(void) const
+{
+	return frames > 0 ? (double)(coarse_evaluations + fine_evaluations)/frames : 0;
+}
+
+// largest amount of iterations of the pattern search in one frame (the centre only moves to better probes,
+// so it stops anyway, this only bounds plateaus of equal distances)
+#define PATTERN_MAX_ITERATIONS 64
+
+// large diamond pattern, in grid units
+static const int large_diamond[8][2] = {{0, -2}, {-1, -1}, {1, -1}, {-2, 0}, {2, 0}, {-1, 1}, {1, 1}, {0, 2}};
+// large hexagon pattern, in grid units
+static const int large_hexagon[6][2] = {{-1, -2}, {1, -2}, {-2, 0}, {2, 0}, {-1, 2}, {1, 2}};
+// small diamond pattern (last step of diamond and hexagon searches), in grid units
+static const int small_diamond[4][2] = {{0, -1}, {-1, 0}, {1, 0}, {0, 1}};
+// three-step search pattern, in steps
+static const int three_step[8][2] = {{-1, -1}, {0, -1}, {1, -1}, {-1, 0}, {1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+
+// constructor
+PatternSearch::PatternSearch(void)
+{
+	strategy = 0;
+	reach = 0;
+	unit = 1;
+	step = 1;
+	small_pattern = false;
+	done = true;
+	iterations = 0;
+	frames = 0;
+	evaluations = 0;
+}
+
+/**
+ * Function start begins the search of the frame at the prediction. The first step of three-step search
+ * is the largest power of two multiple of the grid stride within the reach.
+ *
+ * \search_strategy the way the pattern is probed and contracted (1 - three-step, 2 - diamond, 3 - hexagon)
+ * \prediction rectangle predicted in the previous frame
+ * \reach_pixels largest shift of probes from the prediction
+ * \stride pixel distance between candidates of the grid
+ */
+void PatternSearch::start(int search_strategy, Rect prediction, int reach_pixels, int stride)
+{
+	strategy = search_strategy;
+	origin = prediction;
+	centre = prediction;
+	reach = reach_pixels;
+	unit = std::max(stride, 1);
+	step = unit;
+	while (2*step <= reach){
+		step *= 2;
+	}
+	small_pattern = false;
+	done = false;
+	iterations = 0;
+	visited.clear();
+	frames++;
+}
+
+/**
+ * Function finished tells if the search of the frame has ended (the pattern contracted below the grid stride,
+ * the small pattern was probed, or the iterations limit was reached)
+ */
+bool PatternSearch::finished(void) const
+{
+	return done || iterations >= PATTERN_MAX_ITERATIONS;
+}
+
+/**
+ * Function probes returns candidates of the current step: the centre first (so it wins ties and the search
+ * does not wander over plateaus) and the points of the pattern, which were not probed yet and lie within
+ * the reach of the origin
+ */
+vector<Rect> PatternSearch::probes(void)
+{
+	const int (*pattern)[2] = three_step;
+	int amount = 8, scale = step;
+	if (strategy == 2 || strategy == 3){
+		pattern = small_pattern ? small_diamond : (strategy == 2 ? large_diamond : large_hexagon);
+		amount = small_pattern ? 4 : (strategy == 2 ? 8 : 6);
+		scale = unit;
+	}
+
+	vector<Rect> candidates(1, centre);
+	visited.insert(make_pair(centre.y, centre.x));
+	for (int p = 0; p < amount; p++){
+		int x = centre.x + pattern[p][0]*scale, y = centre.y + pattern[p][1]*scale;
+		if (abs(x - origin.x) > reach || abs(y - origin.y) > reach || !visited.insert(make_pair(y, x)).second){
+			continue;
+		}
+		candidates.push_back(Rect(x, y, centre.width, centre.height));
+	}
+	return candidates;
+}
+
+/**
+ * Function update moves the centre to the best probe and contracts the pattern: three-step search halves
+ * the step (and ends below the grid stride), diamond and hexagon searches switch to the small diamond once
+ * the centre wins and end after it
+ *
+ * \scored probes, which were evaluated in this step
+ * \best the probe with the smallest distance
+ */
+void PatternSearch::update(const vector<Rect> &scored, Rect best)
+{
+	evaluations += scored.size();
+	iterations++;
+	if (strategy == 1){
+		centre = best;
+		step /= 2;
+		done = step < unit;
+		return;
+	}
+	if (small_pattern){
+		centre = best;
+		done = true;
+		return;
+	}
+	if (best == centre){
+		small_pattern = true;
+	}
+	centre = best;
+}
+
+/**
+ * Function evaluations_per_frame returns the average amount of candidates evaluated per frame
+ * (to compare with cand_param x cand_param of the full grid)
+ */
+double PatternSearch::evaluations_per_frame(void) const
+{
+	return frames > 0 ? (double)evaluations/frames : 0;
+}
+
+// constructor
+MotionPredictor::MotionPredictor(void)
+{
+	initialized = false;
+	gate = 3;
+	process_noise = 1;
+	frames = 0;
+	sides = 0;
+}
+
+/**
+ * Function configure sets up the constant-velocity model: the position moves by the velocity every frame,
+ * the velocity changes by process_noise, measurements (the chosen candidates) lie on the grid, so their noise
+ * is the grid quantization (stride^2/12) plus one pixel of matching error
+ *
+ * \measurement_size amount of measured values (2 - the position)
+ * \control_params amount of control parameters (0 - no control)
+ * \stride pixel distance between candidates of the grid
+ */
+void MotionPredictor::configure(int measurement_size, int control_params, int stride)
+{
+	CV_Assert(measurement_size == 2);
+	filter.init(4, measurement_size, control_params, CV_32F);
+	setIdentity(filter.transitionMatrix);
+	filter.transitionMatrix.at<float>(0, 2) = 1;
+	filter.transitionMatrix.at<float>(1, 3) = 1;
+	setIdentity(filter.measurementMatrix);
+	setIdentity(filter.processNoiseCov, Scalar::all(process_noise));
+	filter.processNoiseCov.at<float>(0, 0) = (float)(process_noise/4);
+	filter.processNoiseCov.at<float>(1, 1) = (float)(process_noise/4);
+	setIdentity(filter.measurementNoiseCov, Scalar::all((double)stride*stride/12 + 1));
+	initialized = false;
+}
+
+/**
+ * Function step corrects the filter with the position measured in the last frame and predicts the position
+ * of the next one. The first call initializes the state at the measurement with unknown velocity.
+ *
+ * \measured position chosen by the tracker in the last frame
+ *
+ * \return predicted position
+ */
+Point MotionPredictor::step(Point measured)
+{
+	Mat measurement(2, 1, CV_32F);
+	measurement.at<float>(0) = (float)measured.x;
+	measurement.at<float>(1) = (float)measured.y;
+	if (!initialized){
+		filter.statePost = Mat::zeros(4, 1, CV_32F);
+		filter.statePost.at<float>(0) = measurement.at<float>(0);
+		filter.statePost.at<float>(1) = measurement.at<float>(1);
+		setIdentity(filter.errorCovPost, Scalar::all(100));
+		filter.errorCovPost.at<float>(0, 0) = filter.measurementNoiseCov.at<float>(0, 0);
+		filter.errorCovPost.at<float>(1, 1) = filter.measurementNoiseCov.at<float>(1, 1);
+		initialized = true;
+	} else {
+		filter.correct(measurement);
+	}
+	const Mat & prediction = filter.predict();
+	return Point(cvRound(prediction.at<float>(0)), cvRound(prediction.at<float>(1)));
+}
+
+/**
+ * Function grid_side returns the side of the candidates grid (cand_param), which covers gate standard deviations
+ * of the innovation covariance H*P*H' + R around the predicted position (the larger of the axes)
+ *
+ * \stride pixel distance between candidates of the grid
+ * \max_side largest side of the grid
+ */
+int MotionPredictor::grid_side(int stride, int max_side)
+{
+	Mat innovation = filter.measurementMatrix*filter.errorCovPre*filter.measurementMatrix.t() + filter.measurementNoiseCov;
+	double variance = std::max(innovation.at<float>(0, 0), innovation.at<float>(1, 1));
+	int reach = (int)std::ceil(gate*std::sqrt(variance));
+	int side = std::min(2*((reach + stride - 1)/stride) + 1, max_side);
+	frames++;
+	sides += side;
+	return side;
+}
+
+/**
+ * Function average_grid_side returns the average side of the candidates grid per frame
+ * (to compare with cand_param given to the tracker)
+ */
+double MotionPredictor::average_grid_side(void) const
+{
+	return frames > 0 ? (double)sides/frames : 0;
+}
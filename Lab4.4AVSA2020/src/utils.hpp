@@ -17,5 +17,6 @@
 
 std::vector<cv::Rect> readGroundTruthFile(std::string groundtruth_path);
 std::vector<float> estimateTrackingPerformance(std::vector<cv::Rect> Bbox_GT, std::vector<cv::Rect> Bbox_est);
+void extractChannelOfInterest(const cv::Mat &frame, int channel_id, cv::Mat &channel_frame);
 
 #endif /* UTILS_HPP_ */
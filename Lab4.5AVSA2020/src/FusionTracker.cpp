@@ -8,7 +8,9 @@
  */
 
 #include <opencv2/opencv.hpp>
+#include <numeric>
 #include "FusionTracker.hpp"
+#include "utils.hpp"
 
 using namespace cv;
 using namespace std;
@@ -48,23 +50,48 @@ using namespace tracker;
  * \f_weight tells how much tracker should relay on color histogram, how much on HOG histogram
 		     - domain [0,1] ;1 - fully color; 0 fully HOG; 0.5 50% color, 50% HOG
  *
+ * \histogram_mode the way candidates color histograms are computed
+ *				 0 - calcHist for every candidate (reference)
+ *				 1 - integral histogram built once per frame over the search region
+ *				 2 - sliding window scan along the candidates grid rows
+ *				 3 - SIMD counting kernel for every candidate
+ *
+ * \hog_computation_mode the way candidates HOG descriptors are computed
+ *				 0 - hog.compute for every candidate (reference)
+ *				 1 - assembled from gradients computed once per frame over the search region
+ *				 2 - assembled from cells of integral orientation histograms built once per frame
+ *
+ * \fast_gradients tells, if gradients of hog_mode 1 and 2 are computed by the vectorised kernel (int16 derivatives,
+ *				 no atan2 nor gamma correction) instead of HOGDescriptor::computeGradient
+ *
  * \return void (it's a starter function).
  *
  */
-FusionTracker::FusionTracker(Mat frame, Rect ground_truth, int bins, int cand, int pix_stride, int channel_id, bool normal_color, bool normal_HOG, double f_weight)
+FusionTracker::FusionTracker(Mat frame, Rect ground_truth, int bins, int cand, int pix_stride, int channel_id, bool normal_color, bool normal_HOG, double f_weight, int histogram_mode, int hog_computation_mode, bool fast_gradients)
 {
 	normalization_color = normal_color;
 	normalization_HOG = normal_HOG;
 	bins_param = bins;
 	cand_param = cand;
+	cand_param_max = cand;
 	p_stride = pix_stride;
 	channel = channel_id;
 	fusion_weight = f_weight;
-
-	//convert to gray scale (for HOG histogram)
-	cvtColor(frame, actual_frame_gray, cv::COLOR_BGR2GRAY);
-	//extracts channel of interest from the frame
-	convert_RGB_to_channel(frame);
+	hist_mode = histogram_mode;
+	hog_mode = hog_computation_mode;
+	hog_cache = false;
+	hog_precision = 0;
+	precision_check = false;
+	hog_batch = false;
+	search_strategy = 0;
+	kalman_search = false;
+	// constant-velocity model of the box position
+	motion.configure(MEASUREMENT_SIZE, CONTROL_PARAMS, p_stride);
+	// block weights of the shared gradient field and of the scratch one (rectangles out of the search region)
+	gradient_field.configure(bins_param);
+	gradient_field.fast_kernel = fast_gradients;
+	outside_field.configure(bins_param);
+	outside_field.fast_kernel = fast_gradients;
 
 	// set up values range for the histogram
 	// if we are looking at h in hsv, set 180, else 256
@@ -76,16 +103,44 @@ FusionTracker::FusionTracker(Mat frame, Rect ground_truth, int bins, int cand, i
 		ranges[1] = 256;
 	}
 	const float * range[] = {ranges};
+	// lookup table value -> bin for the quantized frame
+	actual_bins.configure(bins_param, ranges);
+	// fixed size histograms scoring, used when counts of candidates are available
+	histogram_scorer = hist_mode != 0 ? find_histogram_scorer(bins_param) : 0;
+	score_mode = 0;
+	short_counts = false;
+
+	//saving last prediction for future frame tracking (search region is placed around it)
+	last_prediction = ground_truth;
+
+	//extracts channel of interest and gray scale (for HOG histogram) from the frame
+	convert_RGB_to_channel(frame);
 
 
 	//calculating color histogram
 	gt_hist_color = calculate_histogram(ground_truth,range);
+	// templates for batched scoring
+	batch_scorer.set_template(gt_hist_color);
+	hellinger_scorer.set_template(gt_hist_color);
+	integer_scorer.set_template(gt_hist_color);
+	// bins weights of the likelihood map: the object against the rest of the search region around it
+	if (hist_mode != 0){
+		const int * counts = count_candidate(ground_truth);
+		vector<int> object_counts(counts, counts + bins_param);
+		counts = count_candidate(search_region);
+		vector<int> background_counts(counts, counts + bins_param);
+		for (int b = 0; b < bins_param; b++){
+			background_counts[b] -= object_counts[b];
+		}
+		likelihood_map.set_template(object_counts.data(), background_counts.data(), bins_param);
+	}
+
+	//HOG extractor configured for the box size (fixed per track)
+	hog_extractor.configure(ground_truth.size(), bins_param);
 
 	//calculating gradient histogram
 	gt_hist_HOG = calculate_HOG(ground_truth);
-
-	//saving last prediction for future frame tracking
-	last_prediction = ground_truth;
+	batch_l2.set_template(gt_hist_HOG);
 }
 
 // destructor
@@ -107,8 +162,18 @@ FusionTracker::~FusionTracker(void)
  *
  *	The function returns the vector of candidates (sized cand_param x cand_param),
  *	where there is always included prediction from previous frame.
+ *	With pyramid.levels > 0 the candidates come from the coarse-to-fine search (pyramid_candidates).
+ *	Otherwise with search_strategy 1, 2 and 3 the only candidate is the winner of the pattern search (pattern_candidates).
  */
 vector<Rect>  FusionTracker::generate_candidates(){
+	// coarse-to-fine search instead of the full grid
+	if (pyramid.levels > 0){
+		return pyramid_candidates();
+	}
+	// block-matching pattern search instead of the full grid
+	if (search_strategy != 0){
+		return pattern_candidates();
+	}
 	vector<Rect> candidates;
 	// dimensions of previous frame result-rectangle
 	float height = last_prediction.height;
@@ -140,64 +205,318 @@ vector<Rect>  FusionTracker::generate_candidates(){
 		candidates.push_back(Rect(prev_x-p_stride*counter,prev_y+p_stride*counter,width,height));
 	}
 
+	// origins on the lattice of cells shared by the HOG cache
+	snap_to_cells(candidates);
 	//Deleting candidates out of frame bounds
-	int right_x_limit = actual_frame.cols - width;
-	int down_y_limit = actual_frame.rows - height;
+	discard_out_of_frame(candidates);
+
+	//return vector of candidates
+	return candidates;
+}
+
+/**
+ * Function discard_out_of_frame deletes candidates out of frame bounds (shared by the grid and the pyramid search)
+ *
+ * \candidates vector of candidates
+ */
+void FusionTracker::discard_out_of_frame(vector<Rect> &candidates)
+{
+	Rect origins = candidate_origins(actual_frame.size());
 	for (auto iter = candidates.begin() ; iter != candidates.end(); ) {
-	  if (iter->x<width || iter->x>right_x_limit ||
-				(iter->y)<height || (iter->y)>down_y_limit) {
+	  if (!origins.contains(iter->tl())) {
 		  iter = candidates.erase(iter);
 	  } else {
 		++iter;
 	  }
 	}
+}
 
-	//return vector of candidates
+/**
+ * Function candidate_origins returns the rectangle of top left corners of candidates kept inside the frame: the box
+ * stays at least its size away from the left and top frame borders and fits in at the right and bottom ones.
+ * Both discard_out_of_frame and the clamp of the Kalman prediction use these limits.
+ *
+ * \frame_size size of the actual frame
+ */
+Rect FusionTracker::candidate_origins(Size frame_size)
+{
+	int width = last_prediction.width;
+	int height = last_prediction.height;
+	return Rect(width, height, frame_size.width - 2*width + 1, frame_size.height - 2*height + 1);
+}
+
+/**
+ * Function snap_to_cells moves origins of candidates to the lattice of cell_snap_pitch around last_prediction
+ * (hog_cache in hog_mode 1 and 2), so candidates share cells and blocks of the cache and the scored window is
+ * the candidate itself. Nothing moves if p_stride divides the cell size. The pitch is more than half of p_stride,
+ * so neighbouring candidates stay distinct.
+ *
+ * \candidates vector of candidates
+ */
+void FusionTracker::snap_to_cells(vector<Rect> &candidates)
+{
+	if (!hog_cache || hog_mode == 0 || fusion_weight == 1){
+		return;
+	}
+	int pitch = cell_snap_pitch(p_stride);
+	for (size_t i = 0; i < candidates.size(); i++){
+		candidates[i] = snap_to_lattice(candidates[i], last_prediction.tl(), pitch);
+	}
+}
+
+/**
+ * Function configure_pyramid sets up the coarse-to-fine search: candidates are scored on the search region
+ * downsampled levels times (sparse grid, color histogram and HOG descriptor of the coarse box fused like
+ * in find_best_candidate) and only the full resolution neighbourhoods of the top_k best of them are returned
+ * by generate_candidates. The coarse templates are taken from the frame given to the constructor, so it has to be
+ * called before the first tracking step.
+ * Levels are reduced if the coarse box would be smaller than one HOG block (16 pixels).
+ *
+ * \levels amount of pyramid levels (0 - the whole candidates grid is scored)
+ * \top_k amount of best coarse candidates refined on the full resolution
+ */
+void FusionTracker::configure_pyramid(int levels, int top_k)
+{
+	pyramid.configure(levels, top_k, last_prediction.size(), 16);
+	if (pyramid.levels == 0){
+		return;
+	}
+	downsample_search_region();
+	Rect coarse_box = pyramid.coarse_rect(last_prediction);
+	coarse_gt_hist_color = coarse_histogram(coarse_box).clone();
+	coarse_extractor.configure(coarse_box.size(), bins_param);
+	coarse_gt_hist_HOG = coarse_extractor.compute(coarse_frame_gray(coarse_box), normalization_HOG).clone();
+}
+
+/**
+ * Function downsample_search_region builds the coarse levels of the search region of actual_frame
+ * and actual_frame_gray (the gray one is shared, if the channel of interest is gray)
+ */
+void FusionTracker::downsample_search_region(void)
+{
+	pyramid.downsample(actual_frame_gray, search_region, coarse_frame_gray);
+	if (channel == 0){
+		coarse_frame = coarse_frame_gray;
+	} else {
+		pyramid.downsample(actual_frame, search_region, coarse_frame);
+	}
+}
+
+/**
+ * Function pyramid_candidates scores coarse candidates (Bhattacharyya and L2 distances to the coarse templates,
+ * normalized by their sums and combined with fusion_weight) and returns full resolution candidates around
+ * the best top_k of them (the capture range is the same as the one of the candidates grid)
+ */
+vector<Rect>  FusionTracker::pyramid_candidates(void)
+{
+	int reach = p_stride*(cand_param/2);
+	downsample_search_region();
+
+	vector<Rect> coarse_candidates = pyramid.coarse_grid(last_prediction, reach, p_stride);
+	discard_out_of_frame(coarse_candidates);
+	vector<double> scores(coarse_candidates.size(), DBL_MAX);
+	vector<double> color_scores(coarse_candidates.size(), 0);
+	vector<double> HOG_scores(coarse_candidates.size(), 0);
+	double normalize_color_sum = 0;
+	double normalize_HOG_sum = 0;
+	for (size_t i = 0; i < coarse_candidates.size(); i++){
+		Rect rectangle = pyramid.coarse_rect(coarse_candidates[i]);
+		if (!pyramid.fits(rectangle, coarse_frame.size())){
+			continue;
+		}
+		if (fusion_weight > 0){
+			color_scores[i] = compareHist( coarse_gt_hist_color, coarse_histogram(rectangle), CV_COMP_BHATTACHARYYA);
+			normalize_color_sum += color_scores[i];
+		}
+		if (fusion_weight < 1){
+			HOG_scores[i] = norm( coarse_gt_hist_HOG, coarse_extractor.compute(coarse_frame_gray(rectangle), normalization_HOG));
+			normalize_HOG_sum += HOG_scores[i];
+		}
+		scores[i] = 0;
+	}
+	// normalized distances combined like in find_best_candidate
+	for (size_t i = 0; i < scores.size(); i++){
+		if (scores[i] == DBL_MAX){
+			continue;
+		}
+		if (normalize_color_sum > 0){
+			scores[i] += fusion_weight*color_scores[i]/normalize_color_sum;
+		}
+		if (normalize_HOG_sum > 0){
+			scores[i] += (1.-fusion_weight)*HOG_scores[i]/normalize_HOG_sum;
+		}
+	}
+
+	vector<Rect> candidates = pyramid.refine(coarse_candidates, scores, last_prediction, reach, p_stride);
+	snap_to_cells(candidates);
+	discard_out_of_frame(candidates);
 	return candidates;
 }
 
+/**
+ * Function pattern_candidates searches the frame with the block-matching pattern of search_strategy: every step
+ * probes the pattern around the best candidate so far (scored by best_candidate_index, the centre first so it wins
+ * ties), moves to the best probe and contracts, until the pattern cannot improve. Probes lie on the candidates grid
+ * within its capture range. Returns only the winner (so find_best_candidate of the tracking step just confirms it).
+ */
+vector<Rect>  FusionTracker::pattern_candidates(void)
+{
+	pattern.start(search_strategy, last_prediction, p_stride*(cand_param/2), p_stride);
+	while (!pattern.finished()){
+		vector<Rect> probes = pattern.probes();
+		discard_out_of_frame(probes);
+		if (probes.empty()){
+			break;
+		}
+		// probes are scored without moving last_prediction
+		int best_index = best_candidate_index(probes);
+		pattern.update(probes, best_index >= 0 ? probes[best_index] : pattern.centre);
+	}
+	return vector<Rect>(1, pattern.centre);
+}
+
+/**
+ * Function coarse_histogram calculates color histogram of the rectangle of the coarse level (calcHist, normalized
+ * like calculate_histogram does)
+ *
+ * \rectangle rectangle in coarse level coordinates
+ */
+Mat FusionTracker::coarse_histogram(Rect rectangle)
+{
+	Mat hist;
+	const float * range[] = {ranges};
+	Mat img_to_compute = coarse_frame(rectangle);
+	calcHist( &img_to_compute, 1, 0, Mat(), hist, 1, &bins_param, range,  true, false);
+	if (normalization_color){
+		normalize( hist, hist, 0.01, 1, NORM_MINMAX, -1, Mat() );
+	}
+	return hist;
+}
+
 /**
  * Function find_best_candidate calculates histograms, scores them all with Bhattacharyya distance
  * and selects best candidate, taking rectangle that has minimal Bhattacharyya distance (to ground truth
  * histogram gt_hist obtained from first frame)
+ * In hist_mode 1 candidates are queried from the integral histogram built once per frame over the search region
+ * (convert_RGB_to_channel, also for every step of the pattern search), so every candidate color histogram takes bins_param lookups regardless of candidate size.
+ * In hist_mode 2 all candidates histograms are computed at once, sliding one running histogram along the grid rows.
+ * If the scoring loop is instantiated for bins_param (fixed size Histogram), counts of candidates are scored
+ * without any allocation, otherwise histograms Mats are scored with compareHist.
+ * In score_mode 1, 2 and 3 counts of all candidates are scored at once (by the batched scorer, the Hellinger embedding
+ * or the integer scorer with square root lookup table).
+ * In score_mode 4 candidates are not counted at all: each of them is one rectangle sum over the integral image
+ * of bins log-ratio weights (likelihood map).
+ * With hog_precision 1 and 2 HOG distances are computed on int8 or fp16 blocks, quantized once per frame (precision_check compares
+ * the candidate with the smallest HOG distance with the one of float distances); only unnormalized blocks of hog_mode 1 and 2
+ * are shared, otherwise float distances are used, quantizing every descriptor being slower.
+ * With hog_batch (and float precision) HOG descriptors are stacked and all distances come from norm expansion and gemm.
  *
  *  \candidates vector of candidates
  *  \return the candidate rectangle that will be object's final prediction for tracked frame
  */
 Rect FusionTracker::find_best_candidate(vector<Rect> candidates){
+	int best_index = best_candidate_index(candidates);
+	// returning the best candidate for actual frame tracking (kept, if no combined distance was valid)
+	if (best_index >= 0){
+		last_prediction = candidates[best_index];
+	}
+	return last_prediction;
+}
+
+/**
+ * Function best_candidate_index scores candidates the way find_best_candidate describes and returns the index
+ * of the best one, without moving last_prediction (-1 if no combined distance was valid)
+ *
+ *  \candidates vector of candidates
+ */
+int FusionTracker::best_candidate_index(const vector<Rect> &candidates){
 	vector<double> color_hist_comp_scores;
 	vector<double> HOG_hist_comp_scores;
+	vector<double> HOG_float_scores;
 	Mat color_candidate_hist;
-	Mat HOG_candidate_hist;
 	double normalize_color_sum = 0;
 	double normalize_HOG_sum = 0;
 	double distance;
+	int best_index = -1;
 
 	// value's range parameter for histogram
 	const float * range[] = {ranges};
 
+	// counts of all candidates (sliding window scan over the candidates grid in hist_mode 2)
+	bool batch_scoring = fusion_weight > 0 && hist_mode != 0 && score_mode != 0;
+	if (fusion_weight > 0 && score_mode != 4 && (hist_mode == 2 || batch_scoring)){
+		count_all_candidates(candidates);
+	}
+	// reduced precision only on blocks of the frame quantized once, not on every normalized descriptor
+	bool HOG_reduced_scoring = fusion_weight < 1 && hog_precision != 0 && !normalization_HOG && hog_mode != 0;
+	// template quantized once for the reduced precision
+	if (HOG_reduced_scoring && reduced_l2.precision != hog_precision){
+		reduced_l2.set_template(gt_hist_HOG, hog_precision);
+	}
+	// HOG distances of all candidates at once, descriptors stacked in chunks
+	bool HOG_batch_scoring = fusion_weight < 1 && hog_batch && !HOG_reduced_scoring;
+	if (HOG_batch_scoring){
+		batch_l2.begin();
+	}
+	// batched scoring of all candidates at once
+	if (batch_scoring){
+		const vector<float> & scores = score_all_candidates(candidates);
+		color_hist_comp_scores.assign(scores.begin(), scores.end());
+		normalize_color_sum = accumulate(color_hist_comp_scores.begin(), color_hist_comp_scores.end(), 0.0);
+	}
+
 	//iterating through all candidates
 	for (auto it = begin (candidates); it != end (candidates); ++it) {
-		//if not HOG mode
-		if (fusion_weight > 0){
-			// calculating color histogram of candidate
-			color_candidate_hist = calculate_histogram(*it,range);
-			// computing Bhattacharyya distance
-			distance = compareHist( gt_hist_color, color_candidate_hist, CV_COMP_BHATTACHARYYA);
+		//if not HOG mode (and color scores not batched)
+		if (fusion_weight > 0 && !batch_scoring){
+			if (histogram_scorer != 0){
+				// fixed size histogram of candidate, scored without allocations
+				const int * counts = hist_mode == 2 ? &candidates_counts[(it - begin (candidates))*bins_param] : count_candidate(*it);
+				distance = histogram_scorer(gt_hist_color.ptr<float>(), counts, normalization_color);
+			} else {
+				// calculating color histogram of candidate
+				if (hist_mode == 2){
+					counts_to_histogram(&candidates_counts[(it - begin (candidates))*bins_param], bins_param, normalization_color, color_candidate_hist);
+				} else {
+					color_candidate_hist = calculate_histogram(*it,range);
+				}
+				// computing Bhattacharyya distance
+				distance = compareHist( gt_hist_color, color_candidate_hist, CV_COMP_BHATTACHARYYA);
+			}
 			color_hist_comp_scores.push_back(distance);
 			normalize_color_sum += distance;
 		}
 
 		//if not color mode
 		if (fusion_weight < 1){
-			// calculating HOG histogram of candidate
-			HOG_candidate_hist = calculate_HOG(*it);
-			//computing L2 (Euclidean) distance between ground true histogram and obtained candidate histogram
-			distance = norm( gt_hist_HOG, HOG_candidate_hist);
+			if (HOG_reduced_scoring){
+				// L2 distance on quantized blocks of the frame (or the quantized descriptor)
+				distance = reduced_HOG_distance(*it);
+				if (precision_check){
+					HOG_float_scores.push_back(norm( gt_hist_HOG, compute_HOG(*it)));
+				}
+			} else {
+				// calculating HOG histogram of candidate (reusable extractor, no copy)
+				const Mat & HOG_candidate_hist = compute_HOG(*it);
+				if (HOG_batch_scoring){
+					batch_l2.add(HOG_candidate_hist);
+					continue;
+				}
+				//computing L2 (Euclidean) distance between ground true histogram and obtained candidate histogram
+				distance = norm( gt_hist_HOG, HOG_candidate_hist);
+			}
 			HOG_hist_comp_scores.push_back(distance);
 			normalize_HOG_sum += distance;
 		}
 	}
+	if (HOG_batch_scoring){
+		const vector<double> & scores = batch_l2.finish();
+		HOG_hist_comp_scores.assign(scores.begin(), scores.end());
+		normalize_HOG_sum = accumulate(HOG_hist_comp_scores.begin(), HOG_hist_comp_scores.end(), 0.0);
+	}
+	if (HOG_reduced_scoring && precision_check){
+		reduced_l2.check_argmin(HOG_hist_comp_scores, HOG_float_scores);
+	}
 	//fusion mode
 	if (0 < fusion_weight && fusion_weight < 1){
 		double min_combinated_distance = 999999;
@@ -209,23 +528,21 @@ Rect FusionTracker::find_best_candidate(vector<Rect> candidates){
 			double dist_combination = (fusion_weight*color_hist_comp_scores[it]) + ((1.-fusion_weight)*HOG_hist_comp_scores[it]);
 			if (min_combinated_distance > dist_combination){
 				min_combinated_distance = dist_combination;
-				last_prediction = candidates[it];
+				best_index = it;
 			}
 		}
 		//color mode
 	} else if(fusion_weight == 1) {
 		// finding index of candidate, which has the smallest distance from the ground truth histogram gt_hist_color
 		int minElementIndex = min_element(color_hist_comp_scores.begin(),color_hist_comp_scores.end()) - color_hist_comp_scores.begin();
-		// returning the best candidate for actual frame tracking
-		last_prediction = candidates[minElementIndex];
+		best_index = minElementIndex;
 	//HOG mode
 	} else if(fusion_weight == 0) {
 		// finding index of candidate, which has the smallest distance from the ground truth histogram gt_hist_HOG
 		int minElementIndex = min_element(HOG_hist_comp_scores.begin(),HOG_hist_comp_scores.end()) - HOG_hist_comp_scores.begin();
-		// returning the best candidate for actual frame tracking
-		last_prediction = candidates[minElementIndex];
+		best_index = minElementIndex;
 	}
-	return last_prediction;
+	return best_index;
 }
 
 
@@ -233,20 +550,45 @@ Rect FusionTracker::find_best_candidate(vector<Rect> candidates){
 /**
  * Function execute_tracking_step conducts tracker step for every frame. Firstly it extracts channel of interest from the frame,
  * later it generates candidates and finally scores them and chooses the best rectangle-candidate, which is returned as the
- * result of tracking
+ * result of tracking (candidates are kept in step_candidates).
+ * With kalman_search the search is moved to the position predicted by the Kalman filter before the conversion
+ * (predict_search_window).
  */
 Rect FusionTracker::execute_tracking_step(Mat frame)
 {
+	// search centred on the position predicted by the constant-velocity model, the grid covers its uncertainty
+	if (kalman_search){
+		predict_search_window(frame.size());
+	}
 	//extracts channel of interest from the frame
 	convert_RGB_to_channel(frame);
 	//generates candidates
-	vector<Rect> list_candidates = generate_candidates();
+	step_candidates = generate_candidates();
 	//scores candidates and return the best one
-	return find_best_candidate(list_candidates);
+	return find_best_candidate(step_candidates);
+}
+
+/**
+ * Function predict_search_window corrects the Kalman filter with the previous result, moves last_prediction
+ * to the predicted position (clamped to candidate_origins) and sets cand_param from the innovation covariance
+ * (at most cand_param_max), so the search region and candidates grid are placed around the prediction
+ *
+ * \frame_size size of the actual frame
+ */
+void FusionTracker::predict_search_window(Size frame_size)
+{
+	Point predicted = motion.step(last_prediction.tl());
+	// the box is kept where discard_out_of_frame keeps candidates
+	Rect origins = candidate_origins(frame_size);
+	predicted.x = std::min(std::max(predicted.x, origins.x), origins.x + origins.width - 1);
+	predicted.y = std::min(std::max(predicted.y, origins.y), origins.y + origins.height - 1);
+	last_prediction = Rect(predicted, last_prediction.size());
+	cand_param = motion.grid_side(p_stride, cand_param_max);
 }
 
 /**
  * Function calculates histograms for given candidate rectangle
+ * (in hist_mode 1, 2 and 3 from bins counts of count_candidate)
  *
  * \rectangle the candidate for which histogram will be computed
  * \range the range of histogram values
@@ -257,6 +599,14 @@ Mat FusionTracker::calculate_histogram(Rect rectangle, const float * range[])
 {
 	// matrix which will keep histogram
 	Mat hist;
+
+	// rectangles out of the candidates grid (e.g. ground truth) need their own conversion
+	convert_outside_region(rectangle);
+
+	if (hist_mode != 0){
+		counts_to_histogram(count_candidate(rectangle), bins_param, normalization_color, hist);
+		return hist;
+	}
 	Mat img_to_compute = actual_frame(rectangle);
 	// calculating histogram of candidate
 	calcHist( &img_to_compute, 1, 0, Mat(), hist, 1, &bins_param, range,  true, false);
@@ -268,6 +618,92 @@ Mat FusionTracker::calculate_histogram(Rect rectangle, const float * range[])
 	return hist;
 }
 
+/**
+ * Function count_all_candidates counts bins of all candidates to candidates_counts, bins_param values per candidate
+ * (in hist_mode 2 with one running histogram sliding along the grid rows, otherwise with count_candidate).
+ * In score_mode 3 counts go to candidates_counts_short instead, if the candidate area fits to ushort.
+ *
+ * \candidates vector of candidates
+ */
+void FusionTracker::count_all_candidates(const vector<Rect> &candidates)
+{
+	short_counts = score_mode == 3 && !candidates.empty() && candidates[0].area() <= USHRT_MAX;
+	if (hist_mode == 2){
+		if (short_counts){
+			sliding_window_histograms(actual_bins, candidates, candidates_counts_short);
+		} else {
+			sliding_window_histograms(actual_bins, candidates, candidates_counts);
+		}
+		return;
+	}
+	if (short_counts){
+		candidates_counts_short.resize(candidates.size()*bins_param);
+	} else {
+		candidates_counts.resize(candidates.size()*bins_param);
+	}
+	for (size_t i = 0; i < candidates.size(); i++){
+		const int * counts = count_candidate(candidates[i]);
+		if (short_counts){
+			copy(counts, counts + bins_param, &candidates_counts_short[i*bins_param]);
+		} else {
+			copy(counts, counts + bins_param, &candidates_counts[i*bins_param]);
+		}
+	}
+}
+
+/**
+ * Function score_all_candidates scores color counts of all candidates (gathered by count_all_candidates) at once,
+ * with the scorer selected by score_mode (score_mode 4 scores the likelihood map instead, no counts are needed)
+ *
+ * \candidates vector of candidates
+ *
+ * \return Bhattacharyya distances of candidates to gt_hist_color (likelihood distances in score_mode 4), in candidates order
+ */
+const vector<float> & FusionTracker::score_all_candidates(const vector<Rect> &candidates)
+{
+	int amount = candidates.size();
+	if (score_mode == 4){
+		return likelihood_map.score(actual_bins, candidates);
+	}
+	if (score_mode == 1){
+		return batch_scorer.score(candidates_counts.data(), amount, normalization_color);
+	}
+	if (score_mode == 2){
+		return hellinger_scorer.score(candidates_counts.data(), amount, normalization_color);
+	}
+	int area = candidates.empty() ? 0 : candidates[0].area();
+	if (short_counts){
+		return integer_scorer.score(candidates_counts_short.data(), amount, area, normalization_color);
+	}
+	return integer_scorer.score(candidates_counts.data(), amount, area, normalization_color);
+}
+
+/**
+ * Function count_candidate counts bins of the candidate rectangle into the fixed buffer counts_buffer
+ * (taken from the integral histogram in hist_mode 1, if it covers the rectangle,
+ * otherwise in hist_mode 1 and 2 counted from the quantized frame actual_bins;
+ * in hist_mode 3 counted by the SIMD kernel)
+ *
+ * \rectangle the candidate for which bins will be counted
+ *
+ * \return bins counts of the candidate (bins_param + 1 values, the last one gathers values out of range)
+ */
+const int * FusionTracker::count_candidate(Rect rectangle)
+{
+	counts_buffer.assign(bins_param + 1, 0);
+	if (hist_mode == 1 && integral_hist.covers(rectangle)){
+		// integral histogram lookups
+		integral_hist.query(rectangle, counts_buffer.data());
+	} else if (hist_mode == 3){
+		// SIMD counting kernel
+		count_histogram(actual_bins, rectangle, counts_buffer.data());
+	} else {
+		// counting bins indexes of the quantized frame
+		actual_bins.count(rectangle.x, rectangle.x + rectangle.width, rectangle.y, rectangle.height, 1, counts_buffer.data());
+	}
+	return counts_buffer.data();
+}
+
 /**
  * Function calculate_HOG (Histogram of Oriented Gradients) creates histogram of descriptors calculated for given rectangle
  *
@@ -278,32 +714,78 @@ Mat FusionTracker::calculate_histogram(Rect rectangle, const float * range[])
  */
 Mat FusionTracker::calculate_HOG(Rect rectangle)
 {
-	Mat img_to_compute = actual_frame_gray(rectangle);
-	HOGDescriptor hog;
-	vector< float > descriptors;
-
-	//Setting bins amount parameter
-	hog.nbins = bins_param;
-
-	//Making winSize divisible by 8, required by default parameters of HOG algorithm
-	hog.winSize = img_to_compute.size() / 8 * 8;
+	//copy of the descriptor, which stays valid after next candidates are computed
+	return compute_HOG(rectangle).clone();
+}
 
-	//Computing descriptor for candidate rectangle image
-	hog.compute(img_to_compute, descriptors);
+/**
+ * Function compute_HOG creates histogram of descriptors of the candidate with the tracker's HOG extractor
+ * (configured once per track and reused, thus no descriptor set up nor output allocation per candidate).
+ * In hog_mode 1 the descriptor is assembled from the gradient field of the frame, if it covers the candidate.
+ * In hog_mode 2 it is assembled from cells of integral orientation histograms; rectangles out of the search region
+ * get their own gradients and integral histograms (outside_field and outside_orientation, the frame ones are kept),
+ * since such descriptors differ from hog.compute ones.
+ * With hog_cache blocks (and cells in hog_mode 2) are shared between candidates (their origins are snapped
+ * to the cell lattice by snap_to_cells, the descriptor is always the one of the given rectangle).
+ *
+ *  \rectangle candidate, for which there will be calculated HOG histogram
+ *
+ *  \return HOG histogram, valid until the next call
+ */
+const Mat & FusionTracker::compute_HOG(Rect rectangle)
+{
+	// rectangles out of the candidates grid (e.g. ground truth) need their own conversion
+	convert_outside_region(rectangle);
 
-	//Mapping vector<float> to Mat
-	Mat candidate_hist = Mat(descriptors, true);
+	if (hog_mode == 1 && gradient_field.covers(rectangle)){
+		return gradient_field.compute_descriptor(rectangle, normalization_HOG);
+	}
+	if (hog_mode == 2){
+		if (!integral_orientation.covers(rectangle)){
+			// scratch gradients and integral histograms of the rectangle, the ones of the frame (and caches) stay intact
+			outside_field.compute(actual_frame_gray, Rect(rectangle.x - 1, rectangle.y - 1, rectangle.width + 2, rectangle.height + 2));
+			outside_orientation.build(outside_field);
+			return outside_orientation.compute_descriptor(rectangle, normalization_HOG);
+		}
+		return integral_orientation.compute_descriptor(rectangle, normalization_HOG);
+	}
+	return hog_extractor.compute(actual_frame_gray(rectangle), normalization_HOG);
+}
 
-	//normalizing histogram, if demanded in parameters
-	if (normalization_HOG){
-		normalize( candidate_hist, candidate_hist, 0.01, 1, NORM_MINMAX, -1, Mat() );
+/**
+ * Function reduced_HOG_distance computes L2 distance of the candidate descriptor to the template in hog_precision.
+ * Without normalization the descriptor is the concatenation of blocks, so in hog_mode 1 and 2 the distance is summed
+ * over blocks of the frame quantized at their first use (shared by all candidates); candidates outside the gradient
+ * field have their descriptor computed and quantized (it is used only without normalization and in hog_mode 1 and 2).
+ *
+ *  \rectangle candidate
+ */
+double FusionTracker::reduced_HOG_distance(Rect rectangle)
+{
+	if (!normalization_HOG && hog_mode == 1 && gradient_field.covers(rectangle)){
+		return reduced_l2.distance_of_blocks(gradient_field, rectangle);
+	}
+	if (!normalization_HOG && hog_mode == 2 && integral_orientation.covers(rectangle)){
+		return reduced_l2.distance_of_blocks(integral_orientation, rectangle);
 	}
+	return reduced_l2.distance(compute_HOG(rectangle));
+}
 
-	return candidate_hist;
+/**
+ * Function hog_cache_hit_rate returns the share of blocks of candidates descriptors, which were already computed
+ * for other candidates of the same frame (all frames so far, hog_cache in hog_mode 1 and 2)
+ */
+double FusionTracker::hog_cache_hit_rate(void)
+{
+	return hog_mode == 2 ? integral_orientation.block_cache.hit_rate() : gradient_field.block_cache.hit_rate();
 }
 
 /**
  * Function convert_RGB_to_channel extracts appropriate channel from the frame, type of channel depends from parameter channel_id
+ * (fused conversion, no intermediate HSV image nor split planes are created)
+ * Only the search region (bounding box of all candidates around last_prediction) is converted, the rest of actual_frame
+ * and actual_frame_gray is left untouched. The frame is not copied: it has to stay undrawn until the next call,
+ * since pixels out of the search region are converted from it on demand.
  * Channel_id - channel mapping
  * 0 - gray
  * 1 - H from HSV
@@ -311,37 +793,96 @@ Mat FusionTracker::calculate_HOG(Rect rectangle)
  * 3 - B from BGR
  * 4 - G from BGR
  * 5 - R from BGR
+ * In hist_mode 1, 2 and 3 it also emits the quantized frame actual_bins (bins indexes taken from precomputed lookup table)
+ * In hist_mode 1 it also builds the integral histogram of the search region (in score_mode 4 the integral image
+ * of the likelihood map instead)
+ * In hog_mode 1 and 2 it also computes gradients of the gray search region, shared by all candidates descriptors
  */
 void FusionTracker::convert_RGB_to_channel(Mat frame)
 {
-	cvtColor(frame, actual_frame_gray, cv::COLOR_BGR2GRAY);
-	Mat split_frame[3];
-	switch(channel) {
-	   case 0  :
-		   cvtColor(frame, actual_frame, cv::COLOR_BGR2GRAY);
-		   break;
-	   case 1  :
-		   cvtColor(frame, actual_frame, cv::COLOR_BGR2HSV);
-		   split(actual_frame, split_frame);
-		   actual_frame = split_frame[0];
-		   break;
-	   case 2 :
-		   cvtColor(frame, actual_frame, cv::COLOR_BGR2HSV);
-		   split(actual_frame, split_frame);
-		   actual_frame = split_frame[1];
-	   	   break;
-	   case 3:
-		   split(frame, split_frame);
-		   actual_frame = split_frame[0];
-	   	   break;
-	   case 4:
-		   split(frame, split_frame);
-		   actual_frame = split_frame[1];
-	   	   break;
-	   case 5:
-		   split(frame, split_frame);
-		   actual_frame = split_frame[2];
-	   	   break;
+	// header of the caller's frame (no copy), read only by convert_outside_region
+	current_frame = frame;
+	search_region = compute_search_region(frame.size());
+
+	// planes keep the size of the frame (allocated once), only the region is written
+	actual_frame_gray.create(frame.size(), CV_8U);
+	Mat region_gray = actual_frame_gray(search_region);
+	cvtColor(frame(search_region), region_gray, cv::COLOR_BGR2GRAY);
+	//computing only the requested plane, in one pass over the region (gray one is already there)
+	if (channel == 0){
+		actual_frame = actual_frame_gray;
+	} else {
+		actual_frame.create(frame.size(), CV_8U);
+		Mat region_channel = actual_frame(search_region);
+		extractChannelOfInterest(frame(search_region), channel, region_channel);
+	}
+
+	// quantizing the channel to bins indexes, shared by all candidates histograms
+	if (hist_mode != 0){
+		actual_bins.quantize(actual_frame, search_region);
+	}
+	// integral tables of the search region, built once per frame and only queried by candidates
+	if (fusion_weight > 0 && hist_mode != 0){
+		if (score_mode == 4){
+			likelihood_map.build(actual_bins, search_region);
+		} else if (hist_mode == 1){
+			integral_hist.build(actual_bins, search_region);
+		}
+	}
+
+	// gradients of the gray search region, computed once for all candidates (if HOG is used)
+	if (hog_mode != 0 && fusion_weight < 1){
+		gradient_field.caching = hog_cache && hog_mode == 1;
+		integral_orientation.caching = hog_cache && hog_mode == 2;
+		gradient_field.compute(actual_frame_gray, search_region);
+		// integral orientation histograms of the search region
+		if (hog_mode == 2){
+			integral_orientation.build(gradient_field);
+		}
+		// quantized blocks of the previous frame are not valid any more
+		if (hog_precision != 0 && !normalization_HOG){
+			reduced_l2.reset_blocks(gradient_field.region, 4*bins_param);
+		}
 	}
 }
 
+/**
+ * Function compute_search_region returns the bounding box of the candidates grid generated around last_prediction
+ * (generate_candidates shifts the box at most (cand_param/2)*p_stride pixels in every direction), clipped to the frame.
+ * It is extended by one pixel, since HOG gradients of the candidate read its neighbouring pixels.
+ *
+ * \frame_size size of the actual frame
+ *
+ * \return the part of the frame, which is read by candidates histograms and descriptors
+ */
+Rect FusionTracker::compute_search_region(Size frame_size)
+{
+	int reach = p_stride*(cand_param/2) + 1;
+	Rect region(last_prediction.x - reach, last_prediction.y - reach,
+			last_prediction.width + 2*reach, last_prediction.height + 2*reach);
+	return region & Rect(Point(0, 0), frame_size);
+}
+
+/**
+ * Function convert_outside_region converts the rectangle (with its one pixel border) from the frame given to
+ * convert_RGB_to_channel, if it does not lie inside the search region (e.g. ground truth rectangle used for visualisation)
+ *
+ * \rectangle the rectangle which will be read from actual_frame and actual_frame_gray
+ */
+void FusionTracker::convert_outside_region(Rect rectangle)
+{
+	Rect area = Rect(rectangle.x - 1, rectangle.y - 1, rectangle.width + 2, rectangle.height + 2) &
+			Rect(Point(0, 0), actual_frame_gray.size());
+	if ((area & search_region) == area || current_frame.empty()){
+		return;
+	}
+	Mat area_gray = actual_frame_gray(area);
+	cvtColor(current_frame(area), area_gray, cv::COLOR_BGR2GRAY);
+	if (channel != 0){
+		Mat area_channel = actual_frame(area);
+		extractChannelOfInterest(current_frame(area), channel, area_channel);
+	}
+	if (hist_mode != 0){
+		actual_bins.quantize(actual_frame, area);
+	}
+}
@@ -57,12 +57,72 @@ using namespace tracker;
 //  - domain [0,1] ;1 - fully color; 0 fully HOG; 0.5 50% color, 50% HOG
 #define FUSION_WEIGHT 0.5
 
+//HISTOGRAM_MODE is the way candidates color histograms are computed
+//				 0 - calcHist for every candidate (reference)
+//				 1 - integral histogram built once per frame over the search region
+//				 2 - sliding window scan along the candidates grid rows
+//				 3 - SIMD counting kernel for every candidate
+#define HISTOGRAM_MODE 0
+
+//SCORE_MODE is the way candidates color histograms are scored (HISTOGRAM_MODE 1, 2 and 3)
+//				 0 - one candidate at a time
+//				 1 - all candidates at once (batched Bhattacharyya)
+//				 2 - all candidates at once (Hellinger embedding, one matrix-vector product)
+//				 3 - all candidates at once (integer counts, square root lookup table)
+//				 4 - all candidates at once (likelihood map: mean log-ratio weight of pixels, one integral image)
+#define SCORE_MODE 0
+
+//HOG_MODE is the way candidates HOG descriptors are computed
+//				 0 - hog.compute for every candidate (reference)
+//				 1 - assembled from gradients computed once per frame over the search region
+//				 2 - assembled from cells of integral orientation histograms built once per frame
+#define HOG_MODE 0
+
+//FAST_GRADIENTS tells, if gradients of HOG_MODE 1 and 2 are computed by the vectorised kernel (int16 derivatives,
+//orientation bins without atan2, approximated magnitudes, no gamma correction) instead of HOGDescriptor::computeGradient
+#define FAST_GRADIENTS false
+
+//HOG_PRECISION is the precision of descriptors in L2 scoring
+//				 0 - float
+//				 1 - int8
+//				 2 - fp16
+//Reduced precision is used only with HOG_MODE 1 or 2 and NORMALIZATION_GRAD false (blocks quantized once per frame), otherwise
+//it is ignored and candidates are scored by float descriptors, since quantizing every descriptor is slower
+#define HOG_PRECISION 0
+//PRECISION_CHECK tells, if float distances are computed too, to report how often the reduced precision chose the same candidate
+#define PRECISION_CHECK false
+
+//HOG_BATCH tells, if L2 distances of all candidates are computed at once (stacked descriptors, norm expansion and gemm)
+#define HOG_BATCH false
+
+//HOG_CACHE tells, if blocks (and cells) of HOG descriptors are computed once per frame and shared by candidates
+//(HOG_MODE 1 and 2; with GRID_PIXEL_STRIDE not dividing 8 the candidates origins are snapped to shared cells)
+#define HOG_CACHE false
+
+//PYRAMID_LEVELS is the amount of image pyramid levels of the coarse-to-fine search (0 - the whole candidates grid
+//is scored); candidates are scored on the downsampled search region first and only the neighbourhoods
+//of the PYRAMID_TOP_K best of them are scored on the full resolution grid
+#define PYRAMID_LEVELS 0
+#define PYRAMID_TOP_K 3
+
+//SEARCH_STRATEGY is the way candidates are searched (PYRAMID_LEVELS 0), block-matching patterns probe around
+//the best candidate so far and contract, instead of scoring the whole grid
+//				 0 - the whole candidates grid
+//				 1 - three-step search
+//				 2 - diamond search
+//				 3 - hexagon-based search
+#define SEARCH_STRATEGY 0
+
+//KALMAN_SEARCH tells, if the search is centred on the position predicted by a constant-velocity Kalman filter and
+//the candidates grid is sized from its innovation covariance (CANDIDATE_GRID_SIDE is then the largest side)
+#define KALMAN_SEARCH false
+
 //main function
 int main(int argc, char ** argv)
 {
 	cout<< "Lab4_5_fusion_tracker" << endl <<
 				" Params: chan " << CHANNEL_TYPE << " cands " << CANDIDATE_GRID_SIDE << " stride " << GRID_PIXEL_STRIDE << " bins " << BINS_NUMBER  <<
-				" normal_col " << NORMALIZATION_COL << " normal_grad " << NORMALIZATION_GRAD << " fusion_weight " << FUSION_WEIGHT << endl;
+				" normal_col " << NORMALIZATION_COL << " normal_grad " << NORMALIZATION_GRAD << " fusion_weight " << FUSION_WEIGHT << " hist_mode " << HISTOGRAM_MODE << " score_mode " << SCORE_MODE << " hog_mode " << HOG_MODE << " hog_cache " << HOG_CACHE << " fast_grad " << FAST_GRADIENTS << " hog_precision " << HOG_PRECISION << " hog_batch " << HOG_BATCH << " pyramid " << PYRAMID_LEVELS << " top_k " << PYRAMID_TOP_K << " search " << SEARCH_STRATEGY << " kalman " << KALMAN_SEARCH << endl;
 	//PLEASE CHANGE 'dataset_path' & 'output_path' ACCORDING TO YOUR PROJECT
 	std::string dataset_path = "/home/janek/avsa/AVSA2020datasets/AVSA_lab4_datasets/datasets/";
 	std::string output_path = "/home/janek/avsa/AVSA2020results/outvideos/";	//location to save output videos
@@ -146,7 +206,15 @@ int main(int argc, char ** argv)
 		int hist_w = 250, hist_h = 250;
 		int bin_w = cvRound( (double) hist_w/BINS_NUMBER );
 		// initialization of tracking class,
-		FusionTracker tracker(frame,list_bbox_gt[0],BINS_NUMBER,CANDIDATE_GRID_SIDE,GRID_PIXEL_STRIDE,CHANNEL_TYPE, NORMALIZATION_COL, NORMALIZATION_GRAD, FUSION_WEIGHT);
+		FusionTracker tracker(frame,list_bbox_gt[0],BINS_NUMBER,CANDIDATE_GRID_SIDE,GRID_PIXEL_STRIDE,CHANNEL_TYPE, NORMALIZATION_COL, NORMALIZATION_GRAD, FUSION_WEIGHT, HISTOGRAM_MODE, HOG_MODE, FAST_GRADIENTS);
+		tracker.hog_cache = HOG_CACHE;
+		tracker.hog_precision = HOG_PRECISION;
+		tracker.precision_check = PRECISION_CHECK;
+		tracker.hog_batch = HOG_BATCH;
+		tracker.score_mode = SCORE_MODE;
+		tracker.search_strategy = SEARCH_STRATEGY;
+		tracker.kalman_search = KALMAN_SEARCH;
+		tracker.configure_pyramid(PYRAMID_LEVELS, PYRAMID_TOP_K);
 		for (;;) {
 			//get frame & check if we achieved the end of the videofile (e.g. frame.data is empty)
 
@@ -164,15 +232,11 @@ int main(int argc, char ** argv)
 			//DO TRACKING
 			//Change the following line with your own code
 
-			//Conducting the tracking step for video's frame - not in usage because we want to get list_candidates for experiment visualisation
-			//list_bbox_est.push_back(tracker.execute_tracking_step(frame));
-
-			//extracts channel of interest from the frame
-			tracker.convert_RGB_to_channel(frame);
-			//generates candidates
-			list_candidates = tracker.generate_candidates();
-			//scores candidates and return the best one
-			list_bbox_est.push_back(tracker.find_best_candidate(list_candidates));
+			//Conducting the tracking step for video's frame (undrawn copy made before the time measurement: the tracker
+			//converts pixels out of its search region from it later, e.g. for the ground truth histogram)
+			list_bbox_est.push_back(tracker.execute_tracking_step(frame_for_crop));
+			//candidates of the step, for experiment visualisation
+			list_candidates = tracker.step_candidates;
 
 			////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -262,6 +326,17 @@ int main(int argc, char ** argv)
 		//print stats about processing time and tracking performance
 		std::cout << "  Average processing time = " << std::accumulate( procTimes.begin(), procTimes.end(), 0.0) / procTimes.size() << " ms/frame" << std::endl;
 		std::cout << "  Average tracking performance = " << std::accumulate( trackPerf.begin(), trackPerf.end(), 0.0) / trackPerf.size() << std::endl;
+		if (PYRAMID_LEVELS > 0)
+			std::cout << "  Pyramid search: candidates scored per frame = " << tracker.pyramid.evaluations_per_frame()
+					<< " (" << tracker.pyramid.coarse_evaluations << " coarse, " << tracker.pyramid.fine_evaluations << " full resolution)" << std::endl;
+		else if (SEARCH_STRATEGY != 0)
+			std::cout << "  Pattern search: candidates evaluated per frame = " << tracker.pattern.evaluations_per_frame() << std::endl;
+		if (KALMAN_SEARCH)
+			std::cout << "  Kalman search: average grid side = " << tracker.motion.average_grid_side() << " (of " << CANDIDATE_GRID_SIDE << ")" << std::endl;
+		if (HOG_CACHE && HOG_MODE != 0)
+			std::cout << "  HOG block cache hit rate = " << tracker.hog_cache_hit_rate() << std::endl;
+		if (PRECISION_CHECK && HOG_PRECISION != 0)
+			std::cout << "  HOG reduced precision argmin agreement = " << tracker.reduced_l2.agreement() << std::endl;
 
 		//release all resources
 		cap.release();			// close inputvideo
@@ -12,6 +12,10 @@
 #ifndef FusionTracker_HPP_INCLUDE
 #define FusionTracker_HPP_INCLUDE
 
+#include "HistogramEngine.hpp"
+#include "HOGEngine.hpp"
+#include "SearchEngine.hpp"
+
 using namespace cv;
 using namespace std;
 
@@ -22,7 +26,7 @@ namespace tracker {
 	//Public functions
 	public:
 		//constructor function
-		FusionTracker(Mat frame, Rect ground_truth, int bins, int cand, int pix_stride, int channel_id, bool normal_color, bool normal_HOG, double f_weight);
+		FusionTracker(Mat frame, Rect ground_truth, int bins, int cand, int pix_stride, int channel_id, bool normal_color, bool normal_HOG, double f_weight, int histogram_mode, int hog_computation_mode, bool fast_gradients);
 
 		//destructor function
 		~FusionTracker(void);
@@ -30,35 +34,96 @@ namespace tracker {
 		//generating candidates
 		vector<Rect>  generate_candidates(void);
 
+		//removes candidates lying (partly) out of the frame
+		void discard_out_of_frame(vector<Rect> &candidates);
+
+		//top left corners of candidates lying inside the frame
+		Rect candidate_origins(Size frame_size);
+
+		//moves origins of candidates to the lattice of cells shared by the HOG cache (hog_cache)
+		void snap_to_cells(vector<Rect> &candidates);
+
+		//sets up coarse-to-fine search (has to be called before tracking, the coarse templates are taken from the first frame)
+		void configure_pyramid(int levels, int top_k);
+
+		//downsamples the search region of the channel and gray planes to the coarse level
+		void downsample_search_region(void);
+
+		//generating candidates by coarse-to-fine search (pyramid.levels > 0)
+		vector<Rect>  pyramid_candidates(void);
+
+		//generating candidates by block-matching pattern search (search_strategy 1, 2 and 3)
+		vector<Rect>  pattern_candidates(void);
+
+		//calculate color histogram of the rectangle of the coarse level
+		Mat coarse_histogram(Rect rectangle);
+
 		//scoring and choosing best candidate
 		Rect find_best_candidate(vector<Rect> candidates);
 
+		//scoring candidates, returns index of the best one (last prediction is not moved)
+		int best_candidate_index(const vector<Rect> &candidates);
+
 		//executes step for every frame
 		Rect execute_tracking_step(Mat frame);
 
+		//moves last prediction to the position predicted by the Kalman filter and sizes the grid (kalman_search)
+		void predict_search_window(Size frame_size);
+
 		// extracrs channel of interest from frame
 		void convert_RGB_to_channel(Mat frame);
 
 		//calculate color histogram for the candidate
 		Mat calculate_histogram(Rect rectangle, const float * range[]);
 
+		//counts bins of the candidate from the quantized frame (hist_mode 1, 2 and 3)
+		const int * count_candidate(Rect rectangle);
+
+		//counts bins of all candidates to candidates_counts (hist_mode 1, 2 and 3)
+		void count_all_candidates(const vector<Rect> &candidates);
+
+		//scores color counts of all candidates at once (score_mode 1, 2 and 3), or their likelihood (score_mode 4)
+		const vector<float> & score_all_candidates(const vector<Rect> &candidates);
+
 		//calculate gradient histogram for the candidate
 		Mat calculate_HOG(Rect rectangle);
 
+		//calculate gradient histogram for the candidate into the extractor buffer (no copy)
+		const Mat & compute_HOG(Rect rectangle);
+
+		//L2 distance of the candidate to the template in reduced precision (hog_precision 1 and 2)
+		double reduced_HOG_distance(Rect rectangle);
+
+		//share of candidates blocks found in the cache (hog_cache)
+		double hog_cache_hit_rate(void);
+
+		//bounding box of the candidates grid around last prediction
+		Rect compute_search_region(Size frame_size);
+
+		//converts the part of the rectangle lying out of the search region
+		void convert_outside_region(Rect rectangle);
+
 		// ground truth color histogram of the tracked object (taken from first frame)
 		Mat gt_hist_color;
 		// ground truth gradient histogram of the tracked object (taken from first frame)
 		Mat gt_hist_HOG;
-		// actual frame (with already extracted channel of interest)
+		// actual frame (with already extracted channel of interest, valid only inside the search region)
 		Mat actual_frame;
-		// actual grame in gray scale (for HOG histogram)
+		// actual grame in gray scale (for HOG histogram, valid only inside the search region)
 		Mat actual_frame_gray;
+		// part of the frame read by the tracker (bounding box of all candidates and their gradient borders),
+		// only this part is converted
+		Rect search_region;
+		// frame passed to convert_RGB_to_channel, not copied (pixels out of the search region are converted from it on demand)
+		Mat current_frame;
 		// algortihm's prediction of object's position established in the previous frame
 		Rect last_prediction;
 		// [cand_param x cand_param] is amount of candidates generated in every frame
 		// (cand_param is side of the grid used to candidates generation,
 		// thus the total candidate amount is cand_param x cand_param)
 		int cand_param;
+		// largest side of the grid (cand_param given to the constructor, kalman_search only shrinks the grid)
+		int cand_param_max;
 		// the pixel distance between candidates rectangles generated in grid
 		int p_stride;
 		//the id of channel of interest for tracker
@@ -85,6 +150,103 @@ namespace tracker {
 		// range of values - parameter for histogram
 		float ranges[2];
 
+		//the way candidates color histograms are computed
+		// 0 - calcHist for every candidate (reference)
+		// 1 - integral histogram built once per frame over the search region
+		// 2 - sliding window scan along the candidates grid rows
+		// 3 - SIMD counting kernel for every candidate
+		int hist_mode;
+
+		// actual frame quantized to bins indexes (used in hist_mode 1, 2 and 3)
+		BinPlane actual_bins;
+		// integral histogram of the search region of the actual frame (built once per frame in hist_mode 1)
+		IntegralHistogram integral_hist;
+		// bins counts of the candidate, bins_param + 1 values (reused by every candidate)
+		vector<int> counts_buffer;
+		// bins counts of all candidates of the actual frame (used in hist_mode 2 and batched scoring)
+		vector<int> candidates_counts;
+		// bins counts of all candidates as ushort (used in score_mode 3, if the candidate area fits)
+		vector<ushort> candidates_counts_short;
+		// tells if counts of the actual frame are in candidates_counts_short
+		bool short_counts;
+		// scoring loop instantiated for bins_param (0 if there is none, or in hist_mode 0)
+		HistogramScorer histogram_scorer;
+
+		//the way candidates color histograms are scored (hist_mode 1, 2 and 3; hist_mode 0 always scores one by one)
+		// 0 - one candidate at a time (compareHist or fixed size Histogram)
+		// 1 - all candidates at once, batched Bhattacharyya over structure of arrays
+		// 2 - all candidates at once, Hellinger embedding scored with one matrix-vector product
+		// 3 - all candidates at once, integer counts with square root lookup table and fixed point coefficient
+		// 4 - all candidates at once, mean log-ratio weight of pixels (likelihood map, one integral image, no histograms)
+		int score_mode;
+		// batched scorer with the precomputed template (used in score_mode 1)
+		BatchBhattacharyya batch_scorer;
+		// embedded template and candidates (used in score_mode 2)
+		HellingerEmbedding hellinger_scorer;
+		// integer scorer with the fixed point template and square root table (used in score_mode 3)
+		IntegerBhattacharyya integer_scorer;
+		// bins log-ratio weights and their integral image over the search region (used in score_mode 4)
+		LikelihoodMap likelihood_map;
+
+		//the way candidates HOG descriptors are computed
+		// 0 - hog.compute for every candidate (reference)
+		// 1 - assembled from gradients computed once per frame over the search region
+		// 2 - assembled from cells of integral orientation histograms built once per frame
+		int hog_mode;
+		//tells if blocks (and cells in hog_mode 2) are cached per frame and shared by candidates (hog_mode 1 and 2)
+		bool hog_cache;
+		//precision of descriptors in L2 scoring
+		// 0 - float (norm)
+		// 1 - int8
+		// 2 - fp16
+		int hog_precision;
+		//tells if float distances are computed too, to check that the reduced precision chose the same candidate
+		bool precision_check;
+		// quantized template, blocks of the frame and candidate, argmin agreement counters (used if hog_precision is not 0)
+		ReducedPrecisionL2 reduced_l2;
+		//tells if L2 distances of all candidates are computed at once by norm expansion and gemm (hog_precision 0)
+		bool hog_batch;
+		// stacked candidates descriptors and the template (used with hog_batch)
+		BatchL2 batch_l2;
+
+		//the way candidates are searched (without the pyramid search)
+		// 0 - the whole candidates grid
+		// 1 - three-step search
+		// 2 - diamond search
+		// 3 - hexagon-based search
+		int search_strategy;
+		// pattern geometry and its evaluation counters (used in search_strategy 1, 2 and 3)
+		PatternSearch pattern;
+		//tells if the search is centred on the position predicted by a constant-velocity Kalman filter
+		//and the candidates grid is sized from its innovation covariance
+		bool kalman_search;
+		// Kalman filter of the box position and the grid sides statistics (used with kalman_search)
+		MotionPredictor motion;
+		// candidates of the last execute_tracking_step (kept for visualisation)
+		vector<Rect> step_candidates;
+		// coarse-to-fine search geometry and its evaluation counters (used if pyramid.levels > 0)
+		PyramidSearch pyramid;
+		// search region of the actual frame downsampled by the pyramid (valid only with pyramid.levels > 0)
+		Mat coarse_frame;
+		// search region of the gray frame downsampled by the pyramid (valid only with pyramid.levels > 0)
+		Mat coarse_frame_gray;
+		// ground truth color histogram of the tracked object on the coarse level (taken from first frame)
+		Mat coarse_gt_hist_color;
+		// ground truth gradient histogram of the tracked object on the coarse level (taken from first frame)
+		Mat coarse_gt_hist_HOG;
+		// HOG descriptor configured for the coarse box
+		HOGExtractor coarse_extractor;
+
+		// HOG descriptor and its buffers, configured once per track and reused by all candidates
+		HOGExtractor hog_extractor;
+		// gradients of the gray search region of the actual frame (used in hog_mode 1 and 2)
+		GradientField gradient_field;
+		// integral orientation histograms of the search region (used in hog_mode 2)
+		IntegralOrientationHistogram integral_orientation;
+		// scratch gradients and integral histograms of rectangles out of the search region (used in hog_mode 2)
+		GradientField outside_field;
+		IntegralOrientationHistogram outside_orientation;
+
 	};
 }
 
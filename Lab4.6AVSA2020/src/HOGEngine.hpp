@@ -0,0 +1,436 @@
+/* Applied Video Sequence Analysis (AVSA)
+ *
+ *	LAB4: HOGEngine
+ *	HOGEngine.hpp
+ *
+ * 	Authors: Sergio Romero & Jan Sieradzki
+ *	VPULab-UAM 2020
+ */
+
+
+#include <opencv2/opencv.hpp>
+#ifndef HOGEngine_HPP_INCLUDE
+#define HOGEngine_HPP_INCLUDE
+
+using namespace cv;
+using namespace std;
+
+namespace tracker {
+
+	// normalizes the block histogram with L2Hys (L2 norm, clipping to threshold, L2 norm again), as HOGDescriptor does
+	void normalize_block_L2Hys(float * hist, int size, float threshold);
+
+	//class
+	// per frame cache of histograms (of cells or blocks) keyed by their top left corner in the frame,
+	// candidates of the grid share them when their origins are aligned
+	class OriginCache{
+	//Public functions
+	public:
+		//constructor function
+		OriginCache(void);
+
+		//forgets all histograms, prepares keys of the region for histograms of value_size values (done once per frame)
+		void reset(Rect key_region, int value_size);
+
+		//returns histogram with top left corner (x, y), or 0 if it was not computed in this frame yet
+		inline float * find(int x, int y)
+		{
+			int slot = slots[(y - region.y)*region.width + (x - region.x)];
+			if (slot < 0){
+				misses++;
+				return 0;
+			}
+			hits++;
+			return &values[(size_t)slot*size];
+		}
+
+		//adds histogram with top left corner (x, y), returns its values to be filled in (valid until the next insert)
+		float * insert(int x, int y);
+
+		//share of lookups, which found the histogram already computed (all frames)
+		double hit_rate(void) const;
+
+		// region of the frame, where histograms can start
+		Rect region;
+		// amount of values of one histogram
+		int size;
+		// slot of the histogram of every origin of the region (-1 if not computed)
+		vector<int> slots;
+		// values of computed histograms
+		vector<float> values;
+		// lookups, which found the histogram (all frames)
+		long long hits;
+		// lookups, which did not find the histogram (all frames)
+		long long misses;
+	};
+
+	// largest divisor of the cell size (8), which is not larger than the stride, candidates origins are snapped to it
+	int cell_snap_pitch(int stride);
+
+	// moves the rectangle to the nearest origin of the lattice of the pitch anchored at anchor
+	Rect snap_to_lattice(Rect rectangle, Point anchor, int pitch);
+
+	//class
+	// HOG descriptor configured once per track (winSize is fixed by the box size) and reused by all candidates
+	// of all frames, together with its descriptor buffer
+	class HOGExtractor{
+	//Public functions
+	public:
+		//constructor function
+		HOGExtractor(void);
+
+		//configures the descriptor for the box size and bins (done again only if the box size changes)
+		void configure(Size box_size, int bins);
+
+		//computes descriptor of the box image into the reusable buffer (valid until the next call)
+		const Mat & compute(const Mat &image, bool normalization);
+
+		// HOG descriptor with default block and cell sizes
+		HOGDescriptor hog;
+		// box size, for which hog was configured
+		Size configured_size;
+		// descriptor values of the last computed box (capacity kept between calls)
+		vector<float> descriptors;
+		// descriptors mapped to Mat without copying, descriptor size x 1 (CV_32F)
+		Mat descriptor;
+	};
+
+	//class
+	// gradients of the frame computed once per frame over the search region (the same magnitudes and orientation bins
+	// HOGDescriptor computes for every candidate), candidates descriptors are assembled from these shared planes
+	// (default HOG parameters: blocks of 2 x 2 cells of 8 x 8 pixels, block stride 8, L2Hys block normalization)
+	class GradientField{
+	//Public functions
+	public:
+		//constructor function
+		GradientField(void);
+
+		//prepares Gaussian and cell interpolation weights of block pixels (done once per track)
+		void configure(int bins);
+
+		//computes gradients of the image over the region (done once per frame)
+		void compute(const Mat &image, Rect search_region);
+
+		//computes gradients of the region with the vectorised kernel (8-bit image, int16 derivatives, orientation bins
+		//found by comparing with bins directions instead of atan2, approximated magnitudes, no gamma correction)
+		void compute_fast(const Mat &image);
+
+		//tells if gradients of the whole HOG window of the rectangle are computed
+		bool covers(Rect rectangle) const;
+
+		//assembles descriptor of the rectangle from the shared gradients (valid until the next call)
+		const Mat & compute_descriptor(Rect rectangle, bool normalization);
+
+		//computes normalized histogram of the block with top left corner (x, y) in frame coordinates
+		void block_histogram(int x, int y, float * hist) const;
+
+		//returns normalized histogram of the block, computed only if it is not in block_cache yet
+		const float * cached_block(int x, int y);
+
+		// descriptor used for its parameters and its gradient computation
+		HOGDescriptor hog;
+		// amount of orientation bins
+		int bins_param;
+		// part of the frame, where gradients are computed (their neighbours have to be valid in the image)
+		Rect region;
+		// two magnitude parts of every pixel of the region, interpolated between two orientation bins (CV_32FC2)
+		Mat grad;
+		// two orientation bins of every pixel of the region (CV_8UC2)
+		Mat qangle;
+		// weights of block pixels for each of 4 cells (Gaussian times cell interpolation), 4 x 16 x 16 values
+		vector<float> cell_weights;
+		// tells if gradients are computed by compute_fast instead of hog.computeGradient
+		bool fast_kernel;
+		// unit vectors (cos, sin) of centres of orientation bins -1 .. bins_param, used by compute_fast
+		vector<float> bin_directions;
+		// descriptor of the last assembled rectangle, descriptor size x 1 (CV_32F)
+		Mat descriptor;
+		// tells if blocks are shared between candidates through block_cache
+		bool caching;
+		// normalized blocks of the actual frame
+		OriginCache block_cache;
+	};
+
+	//class
+	// integral images of gradient magnitude, one per orientation bin, so the orientation histogram of any cell
+	// takes 4 lookups per bin (cells are plain sums, without Gaussian window and interpolation between cells)
+	class IntegralOrientationHistogram{
+	//Public functions
+	public:
+		//constructor function
+		IntegralOrientationHistogram(void);
+
+		//builds integral orientation histograms over the region of the gradient field (done once per frame)
+		void build(const GradientField &gradient_field);
+
+		//tells if the HOG window of the rectangle lies inside the region of integral histograms
+		bool covers(Rect rectangle) const;
+
+		//writes orientation histogram of the cell with top left corner (x, y) in frame coordinates to out
+		void cell_histogram(int x, int y, float * out) const;
+
+		//writes normalized histogram of the block with top left corner (x, y) to out (cells taken from cell_cache)
+		void block_histogram(int x, int y, float * out);
+
+		//returns normalized histogram of the block, computed only if it is not in block_cache yet
+		const float * cached_block(int x, int y);
+
+		//assembles descriptor of the rectangle from cells histograms (valid until the next call)
+		const Mat & compute_descriptor(Rect rectangle, bool normalization);
+
+		// region of the frame, over which integral histograms were built
+		Rect region;
+		// amount of orientation bins
+		int bins_param;
+		// threshold of L2Hys block normalization
+		float threshold;
+		// cumulative magnitudes, (region.height+1) x (region.width+1) x bins_param values
+		vector<double> table;
+		// descriptor of the last assembled rectangle, descriptor size x 1 (CV_32F)
+		Mat descriptor;
+		// tells if cells and blocks are shared between candidates through the caches
+		bool caching;
+		// cells histograms of the actual frame
+		OriginCache cell_cache;
+		// normalized blocks of the actual frame
+		OriginCache block_cache;
+	};
+
+	//class
+	// L2 distance of descriptors to the template in reduced precision (int8 or fp16 values), which reads 2-4 times
+	// less memory per candidate than the float descriptors (blocks of the frame are quantized once and shared by
+	// candidates); it also checks, if the best candidate stays the same
+	class ReducedPrecisionL2{
+	//Public functions
+	public:
+		//constructor function
+		ReducedPrecisionL2(void);
+
+		//quantizes the template descriptor for the precision (done once per track)
+		void set_template(const Mat &gt_descriptor, int descriptor_precision);
+
+		//quantizes the descriptor (after its optional normalization) to out
+		void quantize(const Mat &descriptor, Mat &out) const;
+
+		//L2 distance of the descriptor to the template, computed on quantized values (the descriptor is quantized)
+		double distance(const Mat &descriptor);
+
+		//forgets quantized blocks of the previous frame (origins of the region, blocks of block_size values)
+		void reset_blocks(Rect key_region, int block_size);
+
+		//L2 distance of the descriptor of the rectangle to the template, summed over blocks of the frame quantized once
+		//per frame (block_source is the GradientField or IntegralOrientationHistogram of the frame)
+		template <class BlockSource> double distance_of_blocks(BlockSource &block_source, Rect rectangle);
+
+		//squared L2 distance of quantized values to the template ones, in units of float descriptors
+		double squared_distance(const uchar * values, const uchar * gt_values, int size) const;
+
+		//counts the frame as agreeing, if the best candidate by reduced precision distances is the float path one
+		void check_argmin(const vector<double> &reduced_scores, const vector<double> &float_scores);
+
+		//share of checked frames, in which both precisions chose the same candidate
+		double agreement(void) const;
+
+		//precision of quantized descriptors
+		// 0 - none (float)
+		// 1 - int8 (values scaled by 127)
+		// 2 - fp16
+		int precision;
+		// quantized template descriptor (CV_8S or CV_16S holding fp16)
+		Mat gt_quantized;
+		// quantized descriptor of the candidate (reused by every candidate)
+		Mat candidate_quantized;
+		// blocks of the actual frame quantized at their first use (int8 or fp16 values packed into float slots)
+		OriginCache quantized_blocks;
+		// values of one block
+		int block_values;
+		// float block computed for quantization, if the block source does not cache blocks
+		vector<float> block_buffer;
+		// frames, in which argmin of both precisions was compared
+		long long checked_frames;
+		// checked frames, in which both precisions chose the same candidate
+		long long agreeing_frames;
+	};
+
+	//class
+	// L2 distances in the PCA subspace of HOG blocks of the tracked object, learned once per track: every block b
+	// of the descriptor is projected by the same W (components x block size), which is linear, so
+	// ||W(b - mean) - W(t - mean)|| = ||Wb - Wt||. Blocks of the frame are projected once (at their first use)
+	// and shared by all candidates containing them, thus a candidate costs blocks x components values.
+	class ProjectedL2{
+	//Public functions
+	public:
+		//constructor function
+		ProjectedL2(void);
+
+		//learns the principal components of blocks of the samples (one descriptor per row) and projects the template blocks
+		void learn(const Mat &samples, int dimensions, int block_size, const Mat &gt_hist);
+
+		//forgets projected blocks of the previous frame (origins of the region)
+		void reset_blocks(Rect key_region);
+
+		//L2 distance of the descriptor of the rectangle to the template, summed over blocks of the frame projected once
+		//per frame (block_source is the GradientField or IntegralOrientationHistogram of the frame)
+		template <class BlockSource> double distance_of_blocks(BlockSource &block_source, Rect rectangle);
+
+		//L2 distance of the descriptor to the template, all its blocks projected by one gemm
+		double distance(const Mat &descriptor);
+
+		// amount of kept principal components (0 if not learned)
+		int components;
+		// values of one block
+		int block_values;
+		// principal components of blocks, components x block size (CV_32F)
+		Mat basis;
+		// projected template blocks, blocks x components (CV_32F)
+		Mat gt_projected;
+		// blocks of the actual frame projected at their first use
+		OriginCache projected_blocks;
+		// float block computed for projection, if the block source does not cache blocks
+		vector<float> block_buffer;
+		// projected blocks of the descriptor, blocks x components (CV_32F, used by distance)
+		Mat projected;
+
+	//Private functions
+	private:
+		//projects one block to out (components values)
+		void project(const float * block, float * out) const;
+	};
+
+	//class
+	// dense template matching of cell features by FFT: for every window position of the gradient field region,
+	// the L2 distance between its 8 x 8 cells orientation histograms (plain sums, no block normalization)
+	// and the template cells is ||F||^2 - 2 F.T + ||T||^2, where the cross term is the correlation of every
+	// bin plane of dense cell histograms with the template cells placed on the 8 pixels lattice, and the energy term
+	// the correlation of the squared cell histograms with the lattice of ones. All correlations are summed
+	// in the frequency domain, so the frame takes bins + 1 forward DFTs and one inverse DFT; template spectra
+	// and padded buffers are prepared for the largest search region so far (re-planned, if the region grows).
+	// The score is the L2 distance of raw cell features, not the HOG L2 distance: blocks are neither formed nor
+	// normalized, so its values (and possibly the best window) differ from the descriptor scoring ones.
+	class DenseCellMatcher{
+	//Public functions
+	public:
+		//constructor function
+		DenseCellMatcher(void);
+
+		//takes template cells of the box from the gradient field of the first frame and prepares their spectra
+		//for regions up to max_region (done once per track)
+		void set_template(const GradientField &gradient_field, Rect box, Size max_region);
+
+		//tells if matching all windows of the region is estimated cheaper than scoring the candidates by descriptors
+		bool pays_off(Size region, int candidates_amount, int descriptor_size) const;
+
+		//computes distances of all windows of the gradient field region (done once per frame, if the template is set)
+		void match(const GradientField &gradient_field);
+
+		//distance of the window with top left corner (x, y) in frame coordinates, DBL_MAX if it was not matched
+		double distance(int x, int y) const;
+
+		// amount of orientation bins
+		int bins_param;
+		// cells of the window (columns x rows)
+		Size cells;
+		// size of DFT (padded largest region)
+		Size dft_size;
+		// squared norm of template cells
+		double gt_energy;
+		// template cells, bins x (cells rows x cells columns) (CV_32F)
+		Mat gt_cells;
+		// spectra of template cells of every bin placed on the lattice (CCS packed, CV_32F)
+		vector<Mat> kernel_spectra;
+		// spectrum of the lattice of ones (CCS packed, CV_32F)
+		Mat ones_spectrum;
+		// magnitudes of every bin of the region pixels, then their dense cell sums (region size, CV_32F)
+		vector<Mat> cell_maps;
+		// padded plane transformed by DFT (dft_size, CV_32F)
+		Mat plane;
+		// spectrum of the plane and its product with the kernel spectrum (dft_size, CV_32F)
+		Mat spectrum, product;
+		// sum of all products (dft_size, CV_32F)
+		Mat accumulated;
+		// squared distances minus the template energy of window positions (dft_size, CV_32F)
+		Mat surface;
+		// frame region of matched window top left corners
+		Rect matched;
+
+	//Private functions
+	private:
+		//computes dense cell histograms of the gradient field region to cell_maps
+		void compute_cell_maps(const GradientField &gradient_field);
+
+		//sizes the DFT for regions up to max_region and transforms the template kernels for it
+		void plan(Size max_region);
+	};
+
+	//class
+	// L2 distance with early termination: squared differences are summed in chunks and the candidate is abandoned
+	// as soon as the partial sum exceeds the squared best distance so far
+	class BoundedL2{
+	//Public functions
+	public:
+		//constructor function
+		BoundedL2(void);
+
+		//distance of the descriptor to the template, or DBL_MAX if it is larger than best
+		double distance(const Mat &gt_descriptor, const Mat &descriptor, double best);
+
+		// values summed between two checks of the bound
+		int chunk;
+		// scored candidates (all frames)
+		long long candidates;
+		// candidates abandoned before their last value (all frames)
+		long long abandoned;
+		// descriptor values of all scored candidates (all frames)
+		long long values;
+		// values not summed thanks to abandoning (all frames)
+		long long skipped_values;
+	};
+
+	//class
+	// L2 distances of all candidates of the frame by norm expansion ||c - t||^2 = ||c||^2 - 2 c.t + ||t||^2:
+	// descriptors are stacked as rows of one matrix (in chunks of capacity rows, so memory does not grow with the grid),
+	// products c.t of a chunk come from one matrix-vector product (gemm), ||c||^2 are summed while the row is copied;
+	// all of them are in double, since the expansion cancels for candidates close to the template
+	class BatchL2{
+	//Public functions
+	public:
+		//constructor function
+		BatchL2(void);
+
+		//keeps the template descriptor and its squared norm (done once per track)
+		void set_template(const Mat &gt_hist);
+
+		//starts scoring of the candidates of a frame
+		void begin(void);
+
+		//stacks the descriptor of the next candidate (scores the chunk when it is full)
+		void add(const Mat &descriptor);
+
+		//scores the remaining chunk, returns distances of all added candidates in their order (valid until begin)
+		const vector<double> & finish(void);
+
+		// rows of one chunk of stacked descriptors
+		int capacity;
+		// template descriptor, descriptor size x 1 (CV_64F)
+		Mat gt_descriptor;
+		// squared norm of the template (constant, kept only so that scores are distances for fusion normalization)
+		double gt_squared_norm;
+		// stacked descriptors of the chunk, capacity x descriptor size (CV_64F, allocated once)
+		Mat candidates;
+		// rows of candidates filled in the actual chunk
+		int filled;
+		// squared norms of the stacked descriptors
+		vector<double> squared_norms;
+		// products of the stacked descriptors with the template, filled x 1 (CV_64F)
+		Mat products;
+		// L2 distances of candidates of the frame (reused every frame)
+		vector<double> scores;
+
+	//Private functions
+	private:
+		//scores the filled rows of the chunk
+		void flush(void);
+	};
+}
+
+#endif